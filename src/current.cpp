@@ -1,22 +1,43 @@
 #include <Arduino.h>
 #include <climits>
+#include <math.h>
 #include "current.h"
 #include "utils/log.h"
+#include "utils/platform.h"
+#include "utils/probe.h"
+#include "telemetry.h"
+#include "network/network.h"
 #include "screen/screen.h"
 
-#if defined(ESP32)
-  #include "freertos/FreeRTOS.h"
-  #include "freertos/portmacro.h"
-  static portMUX_TYPE g_hashes_mux = portMUX_INITIALIZER_UNLOCKED;
-#elif defined(ESP8266)
-  extern "C" {
-    #include "ets_sys.h"   // ETS_INTR_LOCK / ETS_INTR_UNLOCK
-  }
-#endif
+#define CURRENT_CACHE_LINE 32
+#define CURRENT_HASHRATE_INTERVAL_MS 2000
+
+/**
+ * Hash counter of one miner task. Only its owner writes it, the sampler reads it without
+ * locking (aligned 32-bit loads are atomic) and padding keeps two counters off the same line.
+ */
+struct alignas(CURRENT_CACHE_LINE) HashCounter
+{
+    volatile uint32_t hashes = 0;
+};
 
-// 64-bit running total of all hashes since boot (used by *_by and get_* API)
+static HashCounter g_hash_counters[CORE];
+
+// Owned by the sampler, see current_update_hashrate()
+static uint32_t g_hash_counters_seen[CORE] = {};
+static uint32_t g_hashrate_sampled_ms = 0;
 static volatile uint64_t g_hashes_total = 0;
 
+// kH/s, floats so that a reader on the other core never sees a torn value
+static const float g_hashrate_window_s[HASHRATE_WINDOWS] = {60, 300, 900};
+static volatile float g_hashrate[HASHRATE_WINDOWS] = {};
+static bool g_hashrate_seeded = false;
+
+#define CURRENT_JOB_RETENTION 3
+#define CURRENT_JOBS_RETIRED 8
+// Far longer than a miner slice holds its job snapshot, submit included
+#define CURRENT_JOB_GRACE_MS 2000
+
 char TAG_CURRENT[] = "Current";
 
 // Global variables
@@ -29,14 +50,29 @@ double current_difficulty_highest = 0.0;
 uint64_t current_block_found = 0;
 uint64_t current_hash_accepted = 0;
 uint64_t current_hash_rejected = 0;
-uint32_t current_hashes = 0;
-uint64_t current_hashes_time = 0;
-double current_hashrate = 0;
+uint64_t current_hash_stale = 0;
 uint64_t current_uptime = 0;
 uint64_t current_last_hash = 0;
 
+// Jobs replaced by a notify without clean_jobs, newest first: pools still accept shares for them
+static Job *current_jobs_retained[CURRENT_JOB_RETENTION] = {};
+
+/**
+ * A job no longer mined. A miner task may still be in a slice on it, so it is only freed
+ * after CURRENT_JOB_GRACE_MS: until then its address cannot be reused by a new job and
+ * current_isJobLive() can safely compare pointers.
+ */
+struct RetiredJob
+{
+    Job *job;
+    uint32_t retired_ms;
+};
+static RetiredJob current_jobs_retired[CURRENT_JOBS_RETIRED] = {};
+
 // Function prototypes
+static void current_retireJob(Job *job);
 void deleteCurrentJob();
+void deleteRetainedJobs();
 void deleteCurrentSubscribe();
 void cleanupResources();
 void handleException();
@@ -52,6 +88,11 @@ void current_increment_processedJob()
     current_job_processed++;
 }
 
+const uint32_t current_get_processedJob()
+{
+    return current_job_processed;
+}
+
 void current_setJob(const Notification &notification)
 {
     try
@@ -62,39 +103,149 @@ void current_setJob(const Notification &notification)
             return;
         }
 
-        if (notification.clean_jobs)
+        current_setJob(new Job(notification, *current_subscribe, current_difficulty), notification.clean_jobs);
+    }
+    catch (...)
+    {
+        handleException();
+    }
+}
+
+/**
+ * Replaces the current job with an already built one, taking ownership of it.
+ *
+ * @param job The new job.
+ * @param clean_jobs Whether the previous job is stale (new block).
+ */
+void current_setJob(Job *job, bool clean_jobs)
+{
+    if (clean_jobs)
+    {
+        current_job_is_valid = 0;
+        if (current_job != nullptr)
         {
-            current_job_is_valid = 0;
-            if (current_job != nullptr)
-            {
-                l_debug(TAG_CURRENT, "Job: %s is cleaned and replaced with %s", current_job->job_id.c_str(), notification.job_id.c_str());
-            }
+            l_debug(TAG_CURRENT, "Job: %s is cleaned and replaced with %s", current_job->job_id.c_str(), job->job_id.c_str());
         }
-
+        deleteRetainedJobs();
         deleteCurrentJob();
+    }
+    else if (current_job != nullptr)
+    {
+        // Keep the replaced job for the shares still being found on it, the oldest one goes
+        current_retireJob(current_jobs_retained[CURRENT_JOB_RETENTION - 1]);
+        for (size_t i = CURRENT_JOB_RETENTION - 1; i > 0; i--)
+        {
+            current_jobs_retained[i] = current_jobs_retained[i - 1];
+        }
+        current_jobs_retained[0] = current_job;
+        current_job = nullptr;
+    }
 
-        current_job = new Job(notification, *current_subscribe, current_difficulty);
-        current_job_is_valid = 1;
-        current_increment_processedJob();
-        l_info(TAG_CURRENT, "Job: %s ready to be mined", current_job->job_id.c_str());
+    current_job = job;
+    current_job_is_valid = 1;
+    current_increment_processedJob();
+    l_info(TAG_CURRENT, "Job: %s ready to be mined", current_job->job_id.c_str());
+}
+
+/**
+ * Frees the jobs retired long enough ago and keeps the given one for the grace period.
+ */
+static void current_retireJob(Job *job)
+{
+    const uint32_t now = millis();
+    RetiredJob *oldest = &current_jobs_retired[0];
+    for (RetiredJob &retired : current_jobs_retired)
+    {
+        if (retired.job != nullptr && now - retired.retired_ms > CURRENT_JOB_GRACE_MS)
+        {
+            delete retired.job;
+            retired.job = nullptr;
+        }
+        if (retired.job == nullptr || (oldest->job != nullptr && (int32_t)(retired.retired_ms - oldest->retired_ms) < 0))
+        {
+            oldest = &retired;
+        }
     }
-    catch (...)
+    if (job == nullptr)
     {
-        handleException();
+        return;
+    }
+    if (oldest->job != nullptr)
+    {
+        l_debug(TAG_CURRENT, "Job: %s freed before its grace period", oldest->job->job_id.c_str());
+        delete oldest->job;
     }
+    oldest->job = job;
+    oldest->retired_ms = now;
 }
 
 void deleteCurrentJob()
 {
-    delete current_job;
+    current_retireJob(current_job);
     current_job = nullptr;
 }
 
+void deleteRetainedJobs()
+{
+    for (Job *&job : current_jobs_retained)
+    {
+        current_retireJob(job);
+        job = nullptr;
+    }
+}
+
+/**
+ * Looks up a job still accepting shares: the current one or one replaced without clean_jobs.
+ *
+ * @param job_id The pool job id.
+ * @return The job, nullptr if it is unknown or was cleaned.
+ */
+Job *current_findJob(const std::string &job_id)
+{
+    if (current_job != nullptr && current_job->job_id == job_id)
+    {
+        return current_job;
+    }
+    for (Job *job : current_jobs_retained)
+    {
+        if (job != nullptr && job->job_id == job_id)
+        {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Checks whether a share found on a job can still be submitted. Comparing addresses is safe
+ * for a job snapshot taken by a miner slice, freed jobs are held back, see RetiredJob.
+ */
+bool current_isJobLive(const Job *job)
+{
+    if (job == nullptr)
+    {
+        return false;
+    }
+    if (job == current_job)
+    {
+        return true;
+    }
+    for (const Job *retained : current_jobs_retained)
+    {
+        if (retained == job)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void current_resetSession()
 {
     l_error(TAG_CURRENT, "Session reset");
     deleteCurrentSubscribe();
     current_job_is_valid = 0;
+    deleteRetainedJobs();
     deleteCurrentJob();
 }
 
@@ -109,6 +260,16 @@ void current_setSubscribe(Subscribe *subscribe)
     try
     {
         l_info(TAG_CURRENT, "New session id: %s", subscribe->id.c_str());
+
+        // The job kept alive across a reconnect is only valid if the extranonce did not change
+        if (current_subscribe != nullptr &&
+            (current_subscribe->extranonce1 != subscribe->extranonce1 ||
+             current_subscribe->extranonce2_size != subscribe->extranonce2_size))
+        {
+            current_job_is_valid = 0;
+            deleteRetainedJobs();
+            deleteCurrentJob();
+        }
         deleteCurrentSubscribe();
         current_subscribe = subscribe;
     }
@@ -118,6 +279,37 @@ void current_setSubscribe(Subscribe *subscribe)
     }
 }
 
+/**
+ * Checks whether a subscribe keeps the current session: same extranonce1 and extranonce2 size,
+ * which is what the current job was built on.
+ */
+bool current_isSameSession(const Subscribe &subscribe)
+{
+    return current_subscribe != nullptr &&
+           current_subscribe->extranonce1 == subscribe.extranonce1 &&
+           current_subscribe->extranonce2_size == subscribe.extranonce2_size;
+}
+
+/**
+ * Updates the extranonce of the current session in place (mining.set_extranonce).
+ * The job being mined is left untouched, the next prepared job is built on the new values.
+ * The retained jobs go: their coinbases carry the old extranonce1 and late shares found on
+ * them would only be rejected.
+ */
+void current_setExtranonce(const std::string &extranonce1, int extranonce2_size)
+{
+    if (current_subscribe == nullptr)
+    {
+        l_error(TAG_CURRENT, "Subscribe object is null");
+        return;
+    }
+
+    l_info(TAG_CURRENT, "New extranonce1: %s (extranonce2 size: %d)", extranonce1.c_str(), extranonce2_size);
+    current_subscribe->extranonce1 = extranonce1;
+    current_subscribe->extranonce2_size = extranonce2_size;
+    deleteRetainedJobs();
+}
+
 const char *current_getSessionId()
 {
     return (current_subscribe != nullptr) ? current_subscribe->id.c_str() : nullptr;
@@ -152,9 +344,20 @@ const uint32_t current_get_block_found()
     return current_block_found;
 }
 
+/**
+ * @return The 1 minute hashrate average in kH/s.
+ */
 const double current_get_hashrate()
 {
-    return current_hashrate;
+    return g_hashrate[HASHRATE_1M];
+}
+
+/**
+ * @return The exponentially weighted hashrate average over a window, in kH/s.
+ */
+const double current_get_hashrate(HashrateWindow window)
+{
+    return g_hashrate[window];
 }
 
 void current_setHighestDifficulty(double difficulty)
@@ -211,41 +414,35 @@ void current_increment_hash_rejected()
     }
 }
 
-void current_increment_hashes_by(uint32_t n)
+/**
+ * Adds hashes to the counter of a miner task. Must only be called by that task.
+ *
+ * @param core The miner task, as passed to miner().
+ * @param n The number of hashes.
+ */
+void current_increment_hashes_by(uint32_t core, uint32_t n)
 {
-    // Bump the rolling 1-second bucket that current_update_hashrate() reads
-    // (existing logic expects current_hashes to be a simple counter).
-    if (current_hashes_time == 0) {
-        current_hashes_time = millis();
-    }
-    current_hashes += n;
-
-    // Maintain a 64-bit lifetime total (thread/ISR-safe where applicable).
-#if defined(ESP32)
-    portENTER_CRITICAL(&g_hashes_mux);
-    g_hashes_total += (uint64_t)n;
-    portEXIT_CRITICAL(&g_hashes_mux);
-#elif defined(ESP8266)
-    ETS_INTR_LOCK();
-    g_hashes_total += (uint64_t)n;
-    ETS_INTR_UNLOCK();
-#else
-    g_hashes_total += (uint64_t)n;
-#endif
+    g_hash_counters[core].hashes += n; // wraps, the sampler only looks at differences
 }
 
 // Keep legacy sites working; single step delegates to the batched adder.
 void current_increment_hashes()
 {
-    current_increment_hashes_by(1);
+    current_increment_hashes_by(0, 1);
 }
 
+/**
+ * @return The hashes of every miner task since boot, as of the last hashrate sample.
+ */
 uint64_t current_get_hashes_total(void)
 {
-    // Read without locking on ESP8266 (single core); on ESP32 your read is
-    // typically fine without locking for UI/debug. If you want, you can
-    // guard this with portENTER_CRITICAL just like the writer.
-    return g_hashes_total;
+    // Written by miner task 0, read twice so that a carry into the high word is never half seen
+    uint64_t total;
+    do
+    {
+        total = g_hashes_total;
+    } while (total != g_hashes_total);
+    return total;
 }
 
 const uint32_t current_get_hash_rejected()
@@ -253,6 +450,31 @@ const uint32_t current_get_hash_rejected()
     return current_hash_rejected;
 }
 
+/**
+ * Counts a share rejected because its job was already replaced, apart from the real rejects.
+ */
+void current_increment_hash_stale()
+{
+    current_hash_stale++;
+}
+
+const uint32_t current_get_hash_stale()
+{
+    return current_hash_stale;
+}
+
+/**
+ * Carries the share counters and best difficulty over a restart, see network_resume().
+ * Accepted and rejected then count since the last cold boot, not since this one.
+ */
+void current_restoreStats(uint32_t accepted, uint32_t rejected, double highest_difficulty)
+{
+    current_hash_accepted = accepted;
+    current_hash_rejected = rejected;
+    current_difficulty_highest = highest_difficulty;
+    telemetry_seed();
+}
+
 // void current_increment_hashes()
 // {
 //     try
@@ -269,35 +491,73 @@ const uint32_t current_get_hash_rejected()
 //     }
 // }
 
+/**
+ * Samples the miner task counters and folds the rate into the 1, 5 and 15 minute
+ * exponentially weighted averages. Single reader: only miner task 0 calls it.
+ */
 void current_update_hashrate()
 {
-    try
+    const uint32_t now = millis();
+    if (g_hashrate_sampled_ms == 0)
     {
-        if (millis() - current_hashes_time > 1000)
+        for (size_t i = 0; i < CORE; i++)
         {
-            current_hashrate = (current_hashes / ((millis() - current_hashes_time) / 1000.0)) / 1000.0; // KH/s
-            l_debug(TAG_CURRENT, "Hashrate: %.2f kH/s", current_hashrate);
-#if defined(HAS_LCD)
-            screen_loop();
-#endif
-            current_hashes = 0;
-            current_hashes_time = millis();
+            g_hash_counters_seen[i] = g_hash_counters[i].hashes;
         }
+        g_hashrate_sampled_ms = now;
+        return;
     }
-    catch (...)
+
+    const uint32_t elapsed = now - g_hashrate_sampled_ms;
+    if (elapsed < CURRENT_HASHRATE_INTERVAL_MS)
     {
-        handleException();
+        return;
+    }
+
+    uint32_t hashes = 0;
+    for (size_t i = 0; i < CORE; i++)
+    {
+        const uint32_t seen = g_hash_counters[i].hashes;
+        hashes += seen - g_hash_counters_seen[i];
+        g_hash_counters_seen[i] = seen;
+    }
+    g_hashes_total += hashes;
+    g_hashrate_sampled_ms = now;
+
+    const float seconds = elapsed / 1000.0f;
+    const float rate = hashes / seconds / 1000.0f;
+    for (size_t i = 0; i < HASHRATE_WINDOWS; i++)
+    {
+        // The first sample seeds the averages, they would take minutes to climb from 0
+        const float average = g_hashrate_seeded ? g_hashrate[i] : rate;
+        g_hashrate[i] = average + (1.0f - expf(-seconds / g_hashrate_window_s[i])) * (rate - average);
     }
+    g_hashrate_seeded = true;
+
+    l_debug(TAG_CURRENT, "Hashrate: %.2f kH/s (1m %.2f, 5m %.2f, 15m %.2f)", rate, g_hashrate[HASHRATE_1M], g_hashrate[HASHRATE_5M], g_hashrate[HASHRATE_15M]);
+#if defined(HAS_LCD)
+    screen_loop();
+#endif
+    probe_loop();
+    telemetry_loop();
 }
 
 void current_check_stale()
 {
     try
     {
+        static bool restartRequested = false;
+        if (restartRequested)
+        {
+            // The network task is stuck as well, restart without the snapshot
+            ESP.restart();
+        }
         if (millis() - current_last_hash > 200000)
         {
             l_error(TAG_CURRENT, "No hash received in the last 3 minutes. Restarting...");
-            ESP.restart();
+            // Flash writes do not fit this task stack, the network task saves and restarts
+            network_requestRestart("no hash in 3 minutes");
+            restartRequested = true;
         }
     }
     catch (...)
@@ -314,6 +574,7 @@ void handleException()
 
 void cleanupResources()
 {
+    deleteRetainedJobs();
     deleteCurrentJob();
     deleteCurrentSubscribe();
 }
@@ -8,7 +8,7 @@
 extern "C" {
 #endif
 
-void current_increment_hashes_by(uint32_t n);
+void current_increment_hashes_by(uint32_t core, uint32_t n);
 void current_increment_hashes(void);
 uint64_t current_get_hashes_total(void);
 
@@ -21,32 +21,51 @@ uint64_t current_get_hashes_total(void);
 #include "model/notification.h"
 #include "model/configuration.h"
 
+enum HashrateWindow : uint8_t
+{
+    HASHRATE_1M,
+    HASHRATE_5M,
+    HASHRATE_15M,
+    HASHRATE_WINDOWS
+};
+
 extern Job *current_job;
 #if defined(ESP32)
 extern Job *current_job_next;
 #endif
 extern uint16_t current_job_is_valid;
+extern Subscribe *current_subscribe;
 
 
 
 
 void current_setJob(const Notification &notification);
+void current_setJob(Job *job, bool clean_jobs);
+Job *current_findJob(const std::string &job_id);
+bool current_isJobLive(const Job *job);
 const char *current_getJobId();
 const char *current_getUptime();
 void current_setSubscribe(Subscribe *subscribe);
 const char *current_getSessionId();
+bool current_isSameSession(const Subscribe &subscribe);
+void current_setExtranonce(const std::string &extranonce1, int extranonce2_size);
 void current_resetSession();
 void current_setDifficulty(double difficulty);
 const double current_getDifficulty();
 void current_increment_block_found();
 const uint32_t current_get_block_found();
 const double current_get_hashrate();
+const double current_get_hashrate(HashrateWindow window);
 void current_setHighestDifficulty(double difficulty);
 const double current_getHighestDifficulty();
 void current_increment_hash_accepted();
 const uint32_t current_get_hash_accepted();
 void current_increment_hash_rejected();
 const uint32_t current_get_hash_rejected();
+void current_increment_hash_stale();
+const uint32_t current_get_hash_stale();
+void current_restoreStats(uint32_t accepted, uint32_t rejected, double highest_difficulty);
+const uint32_t current_get_processedJob();
 void current_increment_processedJob();
 void current_increment_hashes();
 void current_update_hashrate();
@@ -3,6 +3,8 @@
 
 #define _VERSION "0.0.17"
 #define DIFFICULTY 1e-4
+#define DIFFICULTY_MIN 1e-8
+#define SHARES_PER_MINUTE 6
 
 // Mining
 #define IS_NODE false
@@ -5,12 +5,18 @@
 #include "utils/log.h"
 #include "model/configuration.h"
 #include "network/network.h"
+#include "network/pool.h"
+#include "network/capture.h"
+#include "network/metrics.h"
 #include "network/accesspoint.h"
 #include "utils/blink.h"
+#include "utils/trace.h"
+#include "utils/boot.h"
 #include "miner/miner.h"
 #include "current.h"
 #include "utils/button.h"
 #include "storage/storage.h"
+#include "storage/lifetime.h"
 #include "network/autoupdate.h"
 #include "massdeploy.h"
 #include <ESP8266WiFi.h>
@@ -19,13 +25,20 @@
 #include "screen/screen.h"
 #endif // HAS_LCD
 
+// Time for a serial monitor to attach before the first logs, nothing waits by default
+#ifndef BOOT_SERIAL_DELAY_MS
+#define BOOT_SERIAL_DELAY_MS 0
+#endif
+
 char TAG_MAIN[] = "Main";
 Configuration configuration;
 
 void setup()
 {  
   Serial.begin(115200);
-  delay(1500);
+#if BOOT_SERIAL_DELAY_MS > 0
+  delay(BOOT_SERIAL_DELAY_MS);
+#endif
   Serial.printf("Boot reason: %d\n", ESP.getResetReason().c_str());
   l_info(TAG_MAIN, "LeafMiner - v.%s - (C: %d)", _VERSION, CORE);
   l_info(TAG_MAIN, "Compiled: %s %s", __DATE__, __TIME__);
@@ -41,10 +54,12 @@ void setup()
   *((volatile uint32_t *)0x60000900) &= ~(1);
 #endif // ESP32
 
+  boot_begin(BOOT_STORAGE);
   storage_setup();
   bool force_ap = button_setup();
 
   storage_load(&configuration);
+  boot_end(BOOT_STORAGE);
   configuration.print();
 
   if (configuration.wifi_ssid == "" || force_ap)
@@ -62,6 +77,13 @@ void setup()
 #endif // MASS_WIFI_SSID
   }
 
+  // WiFi associates while the splash shows
+  pool_setup(configuration);
+  network_resume();
+  network_begin();
+  lifetime_setup(LIFETIME_PATH);
+
+  boot_begin(BOOT_SPLASH);
 #if defined(HAS_LCD)
   screen_setup();
 #else
@@ -69,12 +91,16 @@ void setup()
   delay(500);
   Blink::getInstance().blink(BLINK_START);
 #endif // HAS_LCD
+  boot_end(BOOT_SPLASH);
 
-  if (configuration.auto_update == "on")
-  {
-    autoupdate();
-  }
+#if defined(NETWORK_CAPTURE)
+  capture_start(CAPTURE_PATH);
+#endif
+#if defined(TRACE)
+  trace_start(TRACE_PATH);
+#endif
 
+  boot_begin(BOOT_POOL);
   if (network_getJob() == -1)
   {
     l_error(TAG_MAIN, "Failed to connect to network");
@@ -82,15 +108,43 @@ void setup()
     accesspoint_setup();
     return;
   }
+  boot_end(BOOT_POOL);
+
+#if defined(ESP8266)
+  // No task to run it beside the miner: checked once the first job is in, before hashing starts
+  if (configuration.auto_update == "on")
+  {
+    if (pool_get(pool_getActive()).tls)
+    {
+      // A second BearSSL session does not fit the heap next to the pool one
+      l_info(TAG_MAIN, "Update check skipped next to a TLS pool");
+    }
+    else
+    {
+      boot_begin(BOOT_AUTOUPDATE);
+      autoupdate();
+      boot_end(BOOT_AUTOUPDATE);
+    }
+  }
+#endif // ESP8266
+
+  metrics_setup();
 
 #if defined(ESP32)
   btStop();
   xTaskCreatePinnedToCore(currentTaskFunction, "stale", 1024, NULL, 1, NULL, 1);
   xTaskCreatePinnedToCore(buttonTaskFunction, "button", 1024, NULL, 2, NULL, 1);
+  // Owns the pool socket from here on: listen, reconnects, standby and queued submits
+  xTaskCreatePinnedToCore(networkTaskFunction, "network", 8192, NULL, 3, NULL, 0);
   xTaskCreatePinnedToCore(mineTaskFunction, "miner0", 6000, (void *)0, 10, NULL, 1);
 #if CORE == 2
   xTaskCreatePinnedToCore(mineTaskFunction, "miner1", 6000, (void *)1, 11, NULL, 1);
 #endif
+  // Checked once mining runs, an update restarts the board anyway
+  if (configuration.auto_update == "on")
+  {
+    xTaskCreatePinnedToCore(autoupdateTaskFunction, "autoupdate", 8192, NULL, 1, NULL, 0);
+  }
 #elif defined(ESP8266)
   network_listen();
 #endif
@@ -133,13 +187,9 @@ void loop()
 
   // // Miner regelmäßig laufen lassen
   // miner(0);
-  // Pump network on every iteration so we never fall behind on notifies
-  if (WiFi.status() == WL_CONNECTED) {
-    network_listen();
-  } else {
-    l_info(TAG_MAIN, "WiFi not connected. Trying to reconnect...");
-    isConnected(); // handles WiFi and TCP reconnect
-  }
+  // Pump network on every iteration so we never fall behind on notifies;
+  // reconnects are stepped by the state machine, only the pool connect blocks.
+  network_listen();
   miner(0);
 #endif // ESP8266
 }
@@ -4,6 +4,8 @@
 #include "current.h"
 #include "utils/log.h"
 #include "network/network.h"
+#include "utils/probe.h"
+#include "utils/boot.h"
 #if defined(HAS_LCD)
 #include "screen/screen.h"
 #endif
@@ -82,7 +84,7 @@ void miner(uint32_t core)
     uint8_t  hash[SHA256M_BLOCK_SIZE];
 
     // Snapshot the job pointer once, avoid races; bail if missing.
-    const Job* job = current_job;
+    Job* job = current_job;
     if (!job) {
         static uint32_t lastNoJobLogMs = 0;
         uint32_t now = millis();
@@ -97,6 +99,7 @@ void miner(uint32_t core)
     uint32_t local_hashes = 0;
     bool     share_found  = false;
 
+    PROBE_SCOPE(PROBE_MINER_SLICE);
     while ((millis() - t0) < SLICE_MS && current_job_is_valid && job == current_job)
     {
     #if defined(ESP8266)
@@ -104,7 +107,7 @@ void miner(uint32_t core)
     #endif
 
         uint32_t winning_nonce = 0; // will be set by pickaxe on hit
-        if (current_job->pickaxe(core, hash, winning_nonce)) {
+        if (job->pickaxe(core, hash, winning_nonce)) {
             // We only compute difficulty & log when we actually have a candidate.
             const double diff_hash = diff_from_target(hash);
             if (diff_hash > current_getDifficulty()) {
@@ -124,8 +127,12 @@ void miner(uint32_t core)
 
     // Apply batched counters & a single hashrate update per slice.
     if (local_hashes) {
-        current_increment_hashes_by(local_hashes);   // add this helper; fallback: loop or keep old call internally batched
-        current_update_hashrate();
+        boot_end(BOOT_FIRST_HASH);
+        current_increment_hashes_by(core, local_hashes);
+        // Task 0 is the only reader of the per task counters
+        if (core == 0) {
+            current_update_hashrate();
+        }
     }
 
 #if defined(HAS_LCD)
@@ -134,19 +141,21 @@ void miner(uint32_t core)
 
     if (!share_found) return;
 
-    // Re-check job snapshot still valid before using it.
-    if (!job || job != current_job) return;
-
-    l_info(TAG_MINER, "[%d] > [%s] > 0x%.8x - diff %.12f",
-           core, job->job_id.c_str(), found_nonce, found_diff);
-    network_send(job->job_id, job->extranonce2, job->ntime, found_nonce);
-
-    current_setHighestDifficulty(found_diff);
+    // A job replaced without clean_jobs is retained and still takes shares.
+    if (!current_isJobLive(job)) return;
 
+    // A block candidate goes out first, ahead of logging and of the share back-pressure.
     if (littleEndianCompare(hash, job->target.value, 32) < 0) {
+        network_sendBlock(job->job_id, job->extranonce2, job->ntime, found_nonce);
         l_info(TAG_MINER, "[%d] > Found block - 0x%.8x", core, job->block.nonce);
         current_increment_block_found();
+    } else {
+        network_send(job->job_id, job->extranonce2, job->ntime, found_nonce);
     }
+
+    l_info(TAG_MINER, "[%d] > [%s] > 0x%.8x - diff %.12f",
+           core, job->job_id.c_str(), found_nonce, found_diff);
+    current_setHighestDifficulty(found_diff);
 }
 
 
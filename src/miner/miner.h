@@ -2,9 +2,8 @@
 #define MINER_H
 #include <Arduino.h>
 #include "utils/platform.h"
+void miner(uint32_t core);
 #if defined(ESP32)
 void mineTaskFunction(void *pvParameters);
-#else
-void miner(uint32_t core);
 #endif // ESP32
 #endif // MINER_H
\ No newline at end of file
@@ -15,11 +15,13 @@ struct Configuration
     std::string pool_password = "";
     std::string pool_url = "";
     int pool_port = 0;
+    std::string pool_fallback = "";
     std::string blink_enabled = "";
     int blink_brightness = 256;
     std::string lcd_on_start = "";
     std::string miner_type = "";
     std::string auto_update = "";
+    int shares_per_minute = 0;
 
     void print()
     {
@@ -28,12 +30,13 @@ struct Configuration
         l_info(TAG_CONFIGURATION, "wallet_address: %s", wallet_address.c_str());
         l_info(TAG_CONFIGURATION, "pool_password: %s", pool_password.c_str());
         l_info(TAG_CONFIGURATION, "pool_url: %s", pool_url.c_str());
-        l_info(TAG_CONFIGURATION, "pool_url: %s", pool_url.c_str());
+        l_info(TAG_CONFIGURATION, "pool_fallback: %s", pool_fallback.c_str());
         l_info(TAG_CONFIGURATION, "blink_enabled: %s", blink_enabled.c_str());
         l_info(TAG_CONFIGURATION, "blink_brightness: %s", std::to_string(blink_brightness).c_str());
         l_info(TAG_CONFIGURATION, "lcd_on_start: %s", lcd_on_start.c_str());
         l_info(TAG_CONFIGURATION, "miner_type: %s", miner_type.c_str());
         l_info(TAG_CONFIGURATION, "auto_update: %s", auto_update.c_str());
+        l_info(TAG_CONFIGURATION, "shares_per_minute: %s", std::to_string(shares_per_minute).c_str());
     }
 };
 
@@ -5,6 +5,7 @@
 #include "esp_random.h"
 #endif
 #include <climits>
+#include "utils/probe.h"
 
 uint8_t Job::pickaxe(uint32_t core, uint8_t *hash, uint32_t &winning_nonce)
 {
@@ -25,6 +26,7 @@ void Job::nextNonce(uint32_t core)
 
 Job::Job(const Notification &notification, const Subscribe &subscribe, double difficulty) : difficulty(difficulty)
 {
+    PROBE_SCOPE(PROBE_JOB_BUILD);
     try
     {
         // Initialize variables
@@ -73,6 +75,25 @@ Job::Job(const Notification &notification, const Subscribe &subscribe, double di
     }
 }
 
+/**
+ * Builds a job from a ready made header, as sent by Stratum V2 standard channels
+ * where the pool already computed the merkle root.
+ *
+ * @param job_id The pool job id.
+ * @param header The block header, in the byte order hashed by the miner.
+ * @param difficulty The share difficulty.
+ */
+Job::Job(const std::string &job_id, const Block &header, double difficulty) : block(header), job_id(job_id), difficulty(difficulty)
+{
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", header.ntime);
+    ntime = hex;
+    snprintf(hex, sizeof(hex), "%08x", header.nbits);
+    target.calculate(hex);
+    block.nonce = 0;
+    nerd_mids(&sha, reinterpret_cast<unsigned char *>(&block));
+}
+
 std::string Job::generate_extra_nonce2(int extranonce2_size)
 {
     try
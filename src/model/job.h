@@ -23,6 +23,7 @@ public:
     std::string ntime;
 
     Job(const Notification &notification, const Subscribe &subscribe, double difficulty);
+    Job(const std::string &job_id, const Block &header, double difficulty);
 
     uint8_t pickaxe(uint32_t core, uint8_t *hash, uint32_t &winning_nonce);
 
@@ -44,6 +44,8 @@ std::string prepareHtmlWithValues(const Configuration &configuration)
     replacePattern(html, "{{pool_password}}", configuration.pool_password);
     replacePattern(html, "{{pool_url}}", configuration.pool_url);
     replacePattern(html, "{{pool_port}}", std::to_string(configuration.pool_port));
+    replacePattern(html, "{{pool_fallback}}", configuration.pool_fallback);
+    replacePattern(html, "{{shares_per_minute}}", std::to_string(configuration.shares_per_minute));
     replacePattern(html, "{{blink_brightness}}", std::to_string(configuration.blink_brightness));
     bool is_blink_on = strcmp(configuration.blink_enabled.c_str(), "on") == 0;
     replacePattern(html, "{{blink_enabled_on}}", is_blink_on ? "checked=\"checked\"" : "");
@@ -121,10 +123,12 @@ void accesspoint_webserver()
         conf.pool_password = request->arg("pool_password").c_str();
         conf.pool_url = request->arg("pool_url").c_str();
         conf.pool_port = request->arg("pool_port").toInt();
+        conf.pool_fallback = request->arg("pool_fallback").c_str();
         conf.blink_enabled = request->arg("blink_enabled").c_str();
         conf.blink_brightness = request->arg("blink_brightness").toInt();
         conf.lcd_on_start = request->arg("lcd_on_start").c_str();
         conf.auto_update = request->arg("auto_update").c_str();
+        conf.shares_per_minute = request->arg("shares_per_minute").toInt();
         storage_save(conf);
 
         request->send(200, "text/html", "<html><body>Data saved successfully!<br/><br/>Please reboot your board!</body></html>"); });
@@ -15,9 +15,14 @@
 #include "model/configuration.h"
 #include "utils/platform.h"
 #include "utils/log.h"
+#include "utils/boot.h"
+#include "network.h"
+#include "storage/session.h"
+#include "storage/lifetime.h"
 
 const std::string AUTOUPDATE_URL = "https://raw.githubusercontent.com/matteocrippa/leafminer/main/version.json";
 const char TAG_AUTOUPDATE[] = "AutoUpdate";
+#define AUTOUPDATE_WIFI_TIMEOUT_MS 60000
 
 #if defined(ESP8266_D)
 std::string DEVICE = "esp8266";
@@ -86,12 +91,21 @@ int compareVersions(const char *version1, const char *version2)
     }
 }
 
+/**
+ * Checks for a newer release and installs it. WiFi belongs to the network state machine:
+ * this waits for it to be joined, up to AUTOUPDATE_WIFI_TIMEOUT_MS, instead of starting
+ * another association under its feet.
+ */
 void autoupdate()
 {
-    l_info(TAG_AUTOUPDATE, "Connecting to %s...", configuration.wifi_ssid.c_str());
-    while (WiFi.waitForConnectResult() != WL_CONNECTED)
+    const uint32_t start = millis();
+    while (network_getState() < NETWORK_DNS)
     {
-        WiFi.begin(configuration.wifi_ssid.c_str(), configuration.wifi_password.c_str());
+        if (millis() - start > AUTOUPDATE_WIFI_TIMEOUT_MS)
+        {
+            l_error(TAG_AUTOUPDATE, "No WiFi, update check skipped");
+            return;
+        }
         delay(500);
     }
 
@@ -191,7 +205,14 @@ void autoupdate()
                                 if (Update.end())
                                 {
                                     l_debug(TAG_AUTOUPDATE, "Update Success: %d", written);
+#if defined(ESP32)
+                                    // The network task owns the flash writers, it saves and restarts
+                                    network_requestRestart("update installed");
+#else
+                                    session_save();
+                                    lifetime_save();
                                     ESP.restart();
+#endif
                                 }
                                 else
                                 {
@@ -226,3 +247,16 @@ void autoupdate()
         l_error(TAG_AUTOUPDATE, "httpCode: %d", httpCode);
     }
 }
+
+#if defined(ESP32)
+/**
+ * Runs the update check next to the miners, then ends.
+ */
+void autoupdateTaskFunction(void *pvParameters)
+{
+    boot_begin(BOOT_AUTOUPDATE);
+    autoupdate();
+    boot_end(BOOT_AUTOUPDATE);
+    vTaskDelete(NULL);
+}
+#endif // ESP32
@@ -1,4 +1,5 @@
 #ifndef AUTOUPDATE_H
 #define AUTOUPDATE_H
 void autoupdate();
+void autoupdateTaskFunction(void *pvParameters);
 #endif // AUTOUPDATE_H
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "capture.h"
+#include "network.h"
+#include "shares.h"
+#include "utils/log.h"
+
+#define CAPTURE_MAGIC "LMCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER_SIZE 512
+#define CAPTURE_LINE_MAX 2048
+
+char TAG_CAPTURE[] = "Capture";
+static File captureFile;
+static bool captureActive = false;
+static bool replaying = false;
+static uint32_t captureLastMs = 0;
+static uint32_t captureBytes = 0;
+static uint32_t captureSyncedBytes = 0;
+static uint32_t captureSyncedMs = 0;
+static uint8_t captureBuffer[CAPTURE_BUFFER_SIZE];
+static size_t captureBuffered = 0;
+static uint32_t replayOutbound = 0;
+
+static bool capture_mount()
+{
+#if defined(ESP8266)
+    return LittleFS.begin();
+#else
+    return LittleFS.begin(true); // format on first use
+#endif
+}
+
+static void capture_flush()
+{
+    if (captureBuffered > 0)
+    {
+        captureFile.write(captureBuffer, captureBuffered);
+        captureBuffered = 0;
+    }
+}
+
+static void capture_write(const uint8_t *data, size_t length)
+{
+    // Lines bigger than the buffer go straight to the file
+    if (captureBuffered + length > CAPTURE_BUFFER_SIZE)
+    {
+        capture_flush();
+        if (length > CAPTURE_BUFFER_SIZE)
+        {
+            captureFile.write(data, length);
+            return;
+        }
+    }
+    memcpy(captureBuffer + captureBuffered, data, length);
+    captureBuffered += length;
+}
+
+static size_t capture_varint(uint8_t *out, uint32_t value)
+{
+    size_t length = 0;
+    do
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    return length;
+}
+
+static bool capture_readVarint(File &file, uint32_t &value)
+{
+    value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7)
+    {
+        const int byte = file.read();
+        if (byte < 0)
+        {
+            return false;
+        }
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Starts recording every stratum line to a new capture file.
+ *
+ * @param path The file to write, replaced if it exists.
+ * @return false if the filesystem or the file could not be opened.
+ */
+bool capture_start(const char *path)
+{
+    capture_stop();
+    if (!capture_mount())
+    {
+        l_error(TAG_CAPTURE, "Unable to mount the filesystem");
+        return false;
+    }
+
+    captureFile = LittleFS.open(path, "w");
+    if (!captureFile)
+    {
+        l_error(TAG_CAPTURE, "Unable to create %s", path);
+        return false;
+    }
+
+    const uint8_t version = CAPTURE_VERSION;
+    captureFile.write(reinterpret_cast<const uint8_t *>(CAPTURE_MAGIC), strlen(CAPTURE_MAGIC));
+    captureFile.write(&version, 1);
+    captureBytes = strlen(CAPTURE_MAGIC) + 1;
+    captureBuffered = 0;
+    captureSyncedBytes = 0;
+    captureSyncedMs = millis();
+    captureLastMs = millis();
+    captureActive = true;
+    l_info(TAG_CAPTURE, "Recording stratum traffic to %s", path);
+    return true;
+}
+
+void capture_stop()
+{
+    if (!captureActive)
+    {
+        return;
+    }
+    capture_flush();
+    captureFile.close();
+    captureActive = false;
+    l_info(TAG_CAPTURE, "Capture stopped, %u bytes", captureBytes);
+}
+
+/**
+ * Syncs the file every CAPTURE_SYNC_MS, LittleFS only keeps what was synced past a reset.
+ * Called from network_listen().
+ */
+void capture_loop()
+{
+    if (!captureActive || captureBytes == captureSyncedBytes || millis() - captureSyncedMs < CAPTURE_SYNC_MS)
+    {
+        return;
+    }
+    capture_flush();
+    captureFile.flush();
+    captureSyncedBytes = captureBytes;
+    captureSyncedMs = millis();
+}
+
+bool capture_isActive()
+{
+    return captureActive;
+}
+
+/**
+ * Appends one line to the capture. Does nothing unless a capture is running.
+ *
+ * @param direction CAPTURE_INBOUND or CAPTURE_OUTBOUND.
+ * @param line The line, a trailing newline is not recorded.
+ * @param length The line length.
+ */
+void capture_record(uint8_t direction, const char *line, size_t length)
+{
+    if (!captureActive || replaying)
+    {
+        return;
+    }
+    if (length > 0 && line[length - 1] == '\n')
+    {
+        length--;
+    }
+
+    const uint32_t now = millis();
+    uint8_t header[11];
+    size_t headerLength = 0;
+    header[headerLength++] = direction;
+    headerLength += capture_varint(header + headerLength, now - captureLastMs);
+    headerLength += capture_varint(header + headerLength, length);
+    captureLastMs = now;
+
+    if (captureBytes + headerLength + length > CAPTURE_MAX_BYTES)
+    {
+        l_error(TAG_CAPTURE, "Capture full");
+        capture_stop();
+        return;
+    }
+
+    capture_write(header, headerLength);
+    capture_write(reinterpret_cast<const uint8_t *>(line), length);
+    captureBytes += headerLength + length;
+}
+
+/**
+ * @return The shares the pool gave a verdict on so far.
+ */
+static uint32_t capture_answeredShares()
+{
+    uint32_t count = 0;
+    for (uint8_t outcome = 0; outcome < SHARE_OUTCOMES; outcome++)
+    {
+        if (outcome != SHARE_TIMED_OUT)
+        {
+            count += shares_count((ShareOutcome)outcome);
+        }
+    }
+    return count;
+}
+
+static void capture_sink(const char *line)
+{
+    (void)line;
+    replayOutbound++;
+}
+
+/**
+ * Feeds the inbound lines of a capture back through the stratum client, with the
+ * socket replaced by a sink that only counts what the client sends. The recorded
+ * requests are sent again under their ids, so the responses are routed as they were.
+ *
+ * @param path The capture file.
+ * @param realtime true to keep the recorded pacing, false to replay at full speed.
+ * @param stats Filled with the replay figures.
+ * @return false if the file is missing or not a capture.
+ */
+bool capture_replay(const char *path, bool realtime, CaptureReplayStats &stats)
+{
+    stats = CaptureReplayStats();
+    if (!capture_mount())
+    {
+        return false;
+    }
+
+    File file = LittleFS.open(path, "r");
+    if (!file)
+    {
+        l_error(TAG_CAPTURE, "Unable to open %s", path);
+        return false;
+    }
+
+    char magic[sizeof(CAPTURE_MAGIC)] = {};
+    file.read(reinterpret_cast<uint8_t *>(magic), strlen(CAPTURE_MAGIC));
+    if (strcmp(magic, CAPTURE_MAGIC) != 0 || file.read() != CAPTURE_VERSION)
+    {
+        l_error(TAG_CAPTURE, "%s is not a capture", path);
+        file.close();
+        return false;
+    }
+
+    char *line = new char[CAPTURE_LINE_MAX + 1];
+    replaying = true;
+    replayOutbound = 0;
+    network_setLoopback(capture_sink);
+
+    int direction;
+    uint32_t delta;
+    uint32_t length;
+    uint32_t waitMs = 0;
+    const uint32_t generation = network_getJobGeneration();
+    const uint32_t answered = capture_answeredShares();
+    while ((direction = file.read()) >= 0 && capture_readVarint(file, delta) && capture_readVarint(file, length))
+    {
+        if (length > CAPTURE_LINE_MAX)
+        {
+            l_error(TAG_CAPTURE, "Line of %u bytes, replay stopped", length);
+            break;
+        }
+        if (file.read(reinterpret_cast<uint8_t *>(line), length) != length)
+        {
+            break;
+        }
+        line[length] = '\0';
+
+        waitMs += delta;
+        if (realtime && waitMs > 0)
+        {
+            delay(waitMs);
+        }
+
+        // A pause ends the burst of lines, as the socket running dry does
+        const uint32_t start = micros();
+        if (waitMs > 0)
+        {
+            network_commitNotify();
+        }
+        waitMs = 0;
+
+        // Outbound lines are sent again under their recorded ids, which the recorded responses answer
+        if (direction != CAPTURE_INBOUND)
+        {
+            const StratumMethod method = network_replayRequest(line);
+            network_flush();
+            if (method == STRATUM_SUBMIT)
+            {
+                stats.submits++;
+                stats.submit_us += micros() - start;
+            }
+            continue;
+        }
+
+        network_receive(line);
+        network_flush();
+        const uint32_t elapsed = micros() - start;
+
+        stats.inbound++;
+        stats.bytes += length;
+        stats.elapsed_us += elapsed;
+        if (elapsed > stats.max_line_us)
+        {
+            stats.max_line_us = elapsed;
+        }
+    }
+
+    // Nothing queued during the replay may reach the pool socket once it is back
+    network_commitNotify();
+    network_flush();
+    network_setLoopback(nullptr);
+    replaying = false;
+    stats.outbound = replayOutbound;
+    stats.jobs = network_getJobGeneration() - generation;
+    stats.answered = capture_answeredShares() - answered;
+    delete[] line;
+    file.close();
+
+    l_info(TAG_CAPTURE, "Replayed %u lines (%u bytes) in %u us, slowest %u us, %u jobs", stats.inbound, stats.bytes, stats.elapsed_us, stats.max_line_us, stats.jobs);
+    l_info(TAG_CAPTURE, "Replayed %u submits in %u us, %u answered", stats.submits, stats.submit_us, stats.answered);
+    return true;
+}
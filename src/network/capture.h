@@ -0,0 +1,43 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Stratum traffic capture, stored on the flash filesystem.
+ *
+ * File layout: the "LMCAP" magic and a format version (U8), then one record per line:
+ *   U8      direction, CAPTURE_OUTBOUND or CAPTURE_INBOUND
+ *   varint  milliseconds since the previous record
+ *   varint  line length, followed by the line bytes (no newline)
+ * Varints are LEB128, so a typical record costs 3 or 4 bytes on top of the line.
+ * The file is synced every CAPTURE_SYNC_MS, a reset loses at most the last interval.
+ */
+#define CAPTURE_PATH "/capture.bin"
+#define CAPTURE_MAX_BYTES (256 * 1024)
+#define CAPTURE_SYNC_MS 1000
+#define CAPTURE_OUTBOUND 0
+#define CAPTURE_INBOUND 1
+
+struct CaptureReplayStats
+{
+    uint32_t inbound = 0;
+    uint32_t outbound = 0; // lines the client sent while handling the replay
+    uint32_t bytes = 0;
+    uint32_t elapsed_us = 0; // time spent in the client, waits excluded
+    uint32_t max_line_us = 0;
+    uint32_t jobs = 0;      // jobs built from the replayed notifies
+    uint32_t submits = 0;   // recorded submits sent again
+    uint32_t submit_us = 0; // time spent sending them
+    uint32_t answered = 0;  // shares the replayed responses gave a verdict on
+};
+
+bool capture_start(const char *path);
+void capture_stop();
+void capture_loop();
+bool capture_isActive();
+void capture_record(uint8_t direction, const char *line, size_t length);
+bool capture_replay(const char *path, bool realtime, CaptureReplayStats &stats);
+
+#endif // CAPTURE_H
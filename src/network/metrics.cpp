@@ -0,0 +1,282 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <ESPAsyncWebServer.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif // ESP8266
+#include "metrics.h"
+#include "network.h"
+#include "pool.h"
+#include "shares.h"
+#include "current.h"
+#include "telemetry.h"
+#include "utils/log.h"
+#include "utils/probe.h"
+#include "utils/boot.h"
+#include "storage/lifetime.h"
+
+char TAG_METRICS[] = "Metrics";
+static AsyncWebServer *metricsServer = nullptr;
+
+// Rendered in place on every scrape and streamed from there, so one scrape at a time.
+// Handlers and disconnects all run on the web server task, a plain flag is enough.
+static char metricsBuffer[METRICS_BUFFER_SIZE];
+static bool metricsSending = false;
+// Next telemetry line to send, the whole ring does not fit the buffer and is sent in chunks
+static size_t telemetryLine = 0;
+static bool telemetrySending = false;
+
+struct MetricsWriter
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+};
+
+static void metrics_printf(MetricsWriter &writer, const char *format, ...)
+{
+    if (writer.length + 1 >= writer.size)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    const int written = vsnprintf(writer.buffer + writer.length, writer.size - writer.length, format, args);
+    va_end(args);
+    if (written > 0)
+    {
+        writer.length += (size_t)written < writer.size - writer.length ? (size_t)written : writer.size - writer.length - 1;
+    }
+}
+
+static void metrics_header(MetricsWriter &writer, const char *name, const char *type, const char *help)
+{
+    metrics_printf(writer, "# HELP leafminer_%s %s\n# TYPE leafminer_%s %s\n", name, help, name, type);
+}
+
+static void metrics_value(MetricsWriter &writer, const char *name, const char *type, const char *help, double value)
+{
+    metrics_header(writer, name, type, help);
+    metrics_printf(writer, "leafminer_%s %.12g\n", name, value);
+}
+
+static void metrics_summary(MetricsWriter &writer, const char *name, const char *help, const ShareLatencySummary &summary)
+{
+    metrics_header(writer, name, "summary", help);
+    metrics_printf(writer, "leafminer_%s{quantile=\"0.5\"} %u\n", name, summary.p50_ms);
+    metrics_printf(writer, "leafminer_%s{quantile=\"0.9\"} %u\n", name, summary.p90_ms);
+    metrics_printf(writer, "leafminer_%s{quantile=\"0.99\"} %u\n", name, summary.p99_ms);
+    // Prometheus wants _sum and _count over every observation, the quantiles cover the latest ones
+    metrics_printf(writer, "leafminer_%s_sum %llu\n", name, (unsigned long long)summary.total_ms);
+    metrics_printf(writer, "leafminer_%s_count %u\n", name, summary.total);
+}
+
+/**
+ * Exports the probe histograms as Prometheus histograms, buckets bounded by powers of 2.
+ * Nothing is exported unless the PROBES build flag is set.
+ */
+static void metrics_probes(MetricsWriter &writer)
+{
+#if defined(PROBES)
+    bool header = false;
+    for (uint8_t i = 0; i < PROBE_COUNT; i++)
+    {
+        const ProbeHistogram &histogram = probe_histogram((ProbeId)i);
+        if (histogram.count == 0)
+        {
+            continue;
+        }
+        if (!header)
+        {
+            metrics_header(writer, "probe_cycles", "histogram", "CPU cycles spent per run of an instrumented stage");
+            header = true;
+        }
+        const char *name = probe_name((ProbeId)i);
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b < PROBE_BUCKETS; b++)
+        {
+            cumulative += histogram.buckets[b];
+            if (histogram.buckets[b] > 0)
+            {
+                metrics_printf(writer, "leafminer_probe_cycles_bucket{probe=\"%s\",le=\"%llu\"} %u\n", name, 1ULL << (b + 1), cumulative);
+            }
+        }
+        metrics_printf(writer, "leafminer_probe_cycles_bucket{probe=\"%s\",le=\"+Inf\"} %u\n", name, histogram.count);
+        metrics_printf(writer, "leafminer_probe_cycles_sum{probe=\"%s\"} %llu\n", name, histogram.cycles);
+        metrics_printf(writer, "leafminer_probe_cycles_count{probe=\"%s\"} %u\n", name, histogram.count);
+    }
+#else
+    (void)writer;
+#endif // PROBES
+}
+
+/**
+ * Renders every metric in the Prometheus text format, without allocating.
+ *
+ * @param buffer Where to render.
+ * @param size The buffer size.
+ * @return The rendered length, the output is truncated if the buffer is too small.
+ */
+size_t metrics_render(char *buffer, size_t size)
+{
+    MetricsWriter writer = {buffer, size, 0};
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    metrics_header(writer, "hashrate_khs", "gauge", "Exponentially weighted hashrate average in kH/s");
+    metrics_printf(writer, "leafminer_hashrate_khs{window=\"1m\"} %.3f\n", current_get_hashrate(HASHRATE_1M));
+    metrics_printf(writer, "leafminer_hashrate_khs{window=\"5m\"} %.3f\n", current_get_hashrate(HASHRATE_5M));
+    metrics_printf(writer, "leafminer_hashrate_khs{window=\"15m\"} %.3f\n", current_get_hashrate(HASHRATE_15M));
+    metrics_value(writer, "hashes_total", "counter", "Hashes computed since boot", current_get_hashes_total());
+
+    metrics_header(writer, "shares_total", "counter", "Shares answered by the pool, accepted and rejected carry over warm restarts");
+    metrics_printf(writer, "leafminer_shares_total{result=\"accepted\"} %u\n", current_get_hash_accepted());
+    metrics_printf(writer, "leafminer_shares_total{result=\"rejected\"} %u\n", current_get_hash_rejected());
+    metrics_printf(writer, "leafminer_shares_total{result=\"stale\"} %u\n", current_get_hash_stale());
+
+    metrics_header(writer, "share_outcomes_total", "counter", "Share lifecycle outcomes");
+    for (uint8_t i = 0; i < SHARE_OUTCOMES; i++)
+    {
+        metrics_printf(writer, "leafminer_share_outcomes_total{outcome=\"%s\"} %u\n", shares_outcomeName((ShareOutcome)i), shares_count((ShareOutcome)i));
+    }
+    metrics_summary(writer, "share_find_to_send_ms", "Time from finding a share to writing it, latest shares", shares_findToSend());
+    metrics_summary(writer, "share_send_to_ack_ms", "Time from writing a share to the pool answer, latest shares", shares_sendToAck());
+
+    const NetworkBlockStats blocks = network_getBlockStats();
+    metrics_header(writer, "block_candidates_total", "counter", "Shares meeting the network target");
+    metrics_printf(writer, "leafminer_block_candidates_total{state=\"found\"} %u\n", blocks.found);
+    metrics_printf(writer, "leafminer_block_candidates_total{state=\"sent\"} %u\n", blocks.sent);
+    metrics_printf(writer, "leafminer_block_candidates_total{state=\"accepted\"} %u\n", blocks.accepted);
+    metrics_printf(writer, "leafminer_block_candidates_total{state=\"rejected\"} %u\n", blocks.rejected);
+    metrics_printf(writer, "leafminer_block_candidates_total{state=\"dropped\"} %u\n", blocks.dropped);
+
+    const LifetimeStats lifetime = lifetime_get();
+    metrics_value(writer, "lifetime_hashes_total", "counter", "Hashes computed over the device lifetime", lifetime.hashes);
+    metrics_header(writer, "lifetime_shares_total", "counter", "Shares answered by the pool over the device lifetime");
+    metrics_printf(writer, "leafminer_lifetime_shares_total{result=\"accepted\"} %u\n", lifetime.accepted);
+    metrics_printf(writer, "leafminer_lifetime_shares_total{result=\"rejected\"} %u\n", lifetime.rejected);
+    metrics_value(writer, "lifetime_blocks_total", "counter", "Blocks found over the device lifetime", lifetime.blocks);
+    metrics_value(writer, "lifetime_uptime_seconds", "counter", "Seconds up over the device lifetime", lifetime.uptime_s);
+    metrics_value(writer, "lifetime_best_difficulty", "gauge", "Highest share difficulty over the device lifetime", lifetime.best_difficulty);
+
+    metrics_value(writer, "jobs_total", "counter", "Jobs received from the pool", current_get_processedJob());
+    metrics_value(writer, "difficulty", "gauge", "Current share difficulty", current_getDifficulty());
+    metrics_value(writer, "best_difficulty", "gauge", "Highest share difficulty since boot", current_getHighestDifficulty());
+
+    const NetworkTxStats tx = network_getTxStats();
+    metrics_value(writer, "stratum_requests_total", "counter", "Stratum requests sent", tx.lines);
+    metrics_value(writer, "stratum_writes_total", "counter", "Socket writes the requests were coalesced into", tx.writes);
+    if (pool_count() > 0 && pool_get(pool_getActive()).rtt_ms != POOL_RTT_UNKNOWN)
+    {
+        metrics_value(writer, "pool_rtt_ms", "gauge", "Round trip time to the active pool", pool_get(pool_getActive()).rtt_ms);
+    }
+
+    metrics_value(writer, "uptime_seconds", "counter", "Seconds since boot", millis() / 1000);
+    metrics_header(writer, "boot_phase_ms", "gauge", "Duration of each boot phase, first_hash counts from power on");
+    for (uint8_t i = 0; i < BOOT_PHASES; i++)
+    {
+        const BootTiming &timing = boot_timing((BootPhase)i);
+        if (timing.end_ms != 0)
+        {
+            metrics_printf(writer, "leafminer_boot_phase_ms{phase=\"%s\"} %u\n", boot_phaseName((BootPhase)i), timing.end_ms - timing.start_ms);
+        }
+    }
+    metrics_value(writer, "heap_free_bytes", "gauge", "Free heap", ESP.getFreeHeap());
+#if defined(ESP8266)
+    metrics_value(writer, "heap_max_block_bytes", "gauge", "Largest allocatable heap block", ESP.getMaxFreeBlockSize());
+#else
+    metrics_value(writer, "heap_max_block_bytes", "gauge", "Largest allocatable heap block", ESP.getMaxAllocHeap());
+    metrics_value(writer, "heap_min_free_bytes", "gauge", "Lowest free heap since boot", ESP.getMinFreeHeap());
+#endif
+    metrics_value(writer, "wifi_rssi_dbm", "gauge", "WiFi signal strength", WiFi.RSSI());
+
+    metrics_probes(writer);
+    return writer.length;
+}
+
+/**
+ * Renders the telemetry ring as CSV, oldest sample first, one chunk at a time.
+ *
+ * @param buffer Where to render.
+ * @param size The room left in the chunk.
+ * @return The rendered length, 0 once every sample was sent.
+ */
+static size_t metrics_telemetryChunk(char *buffer, size_t size)
+{
+    MetricsWriter writer = {buffer, size, 0};
+    TelemetrySample sample;
+    char line[128];
+    while (true)
+    {
+        // Line 0 is the header, line n the n-th oldest sample
+        const size_t count = telemetry_count();
+        int length;
+        if (telemetryLine == 0)
+        {
+            length = snprintf(line, sizeof(line), "uptime_s,hashrate_khs,best_difficulty,free_heap,rtt_ms,accepted,rejected,stale,job_switches\n");
+        }
+        else if (telemetryLine <= count && telemetry_get(count - telemetryLine, sample))
+        {
+            length = snprintf(line, sizeof(line), "%u,%.3f,%.6g,%u,%d,%u,%u,%u,%u\n",
+                              sample.uptime_s, sample.hashrate, sample.best_difficulty, sample.free_heap,
+                              sample.rtt_ms == POOL_RTT_UNKNOWN ? -1 : (int)sample.rtt_ms,
+                              sample.accepted, sample.rejected, sample.stale, sample.job_switches);
+        }
+        else
+        {
+            break;
+        }
+        if (length <= 0 || writer.length + length >= writer.size)
+        {
+            break;
+        }
+        metrics_printf(writer, "%s", line);
+        telemetryLine++;
+    }
+    return writer.length;
+}
+
+/**
+ * Serves METRICS_PATH and METRICS_TELEMETRY_PATH on METRICS_PORT while mining. The setup
+ * web server only runs in AP mode.
+ */
+void metrics_setup()
+{
+    if (metricsServer != nullptr)
+    {
+        return;
+    }
+    metricsServer = new AsyncWebServer(METRICS_PORT);
+    metricsServer->on(METRICS_PATH, HTTP_GET, [](AsyncWebServerRequest *request)
+                      {
+        if (metricsSending)
+        {
+            // The buffer is still being sent to another scraper
+            request->send(503, "text/plain", "Busy");
+            return;
+        }
+        metricsSending = true;
+        request->onDisconnect([]()
+                              { metricsSending = false; });
+        const size_t length = metrics_render(metricsBuffer, sizeof(metricsBuffer));
+        request->send(request->beginResponse(200, "text/plain; version=0.0.4", reinterpret_cast<const uint8_t *>(metricsBuffer), length)); });
+    metricsServer->on(METRICS_TELEMETRY_PATH, HTTP_GET, [](AsyncWebServerRequest *request)
+                      {
+        if (telemetrySending)
+        {
+            request->send(503, "text/plain", "Busy");
+            return;
+        }
+        telemetrySending = true;
+        telemetryLine = 0;
+        request->onDisconnect([]()
+                              { telemetrySending = false; });
+        request->send(request->beginChunkedResponse("text/csv", [](uint8_t *buffer, size_t size, size_t) -> size_t
+                                                    { return metrics_telemetryChunk(reinterpret_cast<char *>(buffer), size); })); });
+    metricsServer->begin();
+    l_info(TAG_METRICS, "Serving metrics on port %d", METRICS_PORT);
+}
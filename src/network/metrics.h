@@ -0,0 +1,12 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stddef.h>
+
+#define METRICS_PORT 9100
+#define METRICS_PATH "/metrics"
+#define METRICS_TELEMETRY_PATH "/telemetry"
+#define METRICS_BUFFER_SIZE 4096
+
+void metrics_setup();
+size_t metrics_render(char *buffer, size_t size);
+#endif // METRICS_H
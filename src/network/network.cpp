@@ -10,26 +10,87 @@
 #include "utils/log.h"
 #include "leafminer.h"
 #include "current.h"
+#include "utils/utils.h"
 #include "utils/blink.h"
+#include "pool.h"
+#include "standby.h"
+#include "sv2.h"
+#include "capture.h"
+#include "stratum.h"
+#include "resolver.h"
+#include "tls.h"
+#include "utils/probe.h"
+#include "utils/trace.h"
+#include "shares.h"
+#include "utils/boot.h"
+#include "storage/session.h"
+#include "storage/lifetime.h"
 
 #define NETWORK_BUFFER_SIZE 2048
 #define NETWORK_TIMEOUT 1000 * 60
 #define NETWORK_DELAY 1222
-#define NETWORK_WIFI_ATTEMPTS 2
-#define NETWORK_STRATUM_ATTEMPTS 2
+#define NETWORK_CONNECT_ATTEMPTS 4
+#define NETWORK_WIFI_TIMEOUT_MS 15000
+#define NETWORK_TCP_TIMEOUT_MS 3000
+#define NETWORK_HANDSHAKE_TIMEOUT_MS 10000
+#define NETWORK_BACKOFF_MIN_MS 500
+#define NETWORK_BACKOFF_MAX_MS 30000
+#define NETWORK_POOL_ATTEMPTS 2
+#define NETWORK_PROBE_INTERVAL_MS 60000
+#define NETWORK_FAILOVER_SILENCE_MS 30000
+#define NETWORK_FAILOVER_LAG_MS 5000
+#define NETWORK_FAILOVER_REJECTS 5
+#define NETWORK_FAILBACK_MS 60000
+#define NETWORK_VARDIFF_INTERVAL_MS 30000
+#define NETWORK_VARDIFF_RATIO 1.5
+#define NETWORK_TX_BUFFER_SIZE 1536
+#define NETWORK_TX_SUBMITS 8
+#define NETWORK_SHARE_SWEEP_MS 1000
+#define NETWORK_SNAPSHOT_INTERVAL_MS 5000
+#define NETWORK_BLOCK_CANDIDATES 2
+#define NETWORK_QUEUED_SHARES 10
+#define NETWORK_JOB_ID_SIZE 65
+#define NETWORK_EXTRANONCE2_SIZE 33
 #define MAX_PAYLOAD_SIZE 384
-#define MAX_PAYLOADS 10
 
-WiFiClient client = WiFiClient();
+// Pool socket, plain or TLS depending on the active pool
+static WiFiClient plainClient;
+static TlsClient secureClient;
+static WiFiClient *client = &plainClient;
 char TAG_NETWORK[8] = "Network";
 uint64_t id = 0;
-uint64_t requestJobId = 0;
 uint8_t isRequestingJob = 0;
-uint32_t authorizeId = 0;
 uint8_t isAuthorized = 0;
+uint8_t isSubscribed = 0;
 extern Configuration configuration;
-char payloads[MAX_PAYLOADS][MAX_PAYLOAD_SIZE]; // Array of payloads
-size_t payloads_count = 0;
+
+/**
+ * A share waiting for the network task or for the session to come back. Only the share
+ * is kept: the submit and its request id are made when it leaves, on the task owning
+ * the request table.
+ */
+struct QueuedShare
+{
+    char job_id[NETWORK_JOB_ID_SIZE];
+    char extranonce2[NETWORK_EXTRANONCE2_SIZE];
+    char ntime[9];
+    uint32_t nonce;
+    uint32_t generation; // jobGeneration when found
+    uint32_t found_ms;
+};
+static QueuedShare queuedShares[NETWORK_QUEUED_SHARES];
+static size_t queuedShareCount = 0;
+
+#if defined(ESP32)
+// The miner tasks queue shares, the network task takes them out
+static portMUX_TYPE sharesMux = portMUX_INITIALIZER_UNLOCKED;
+#define SHARES_LOCK() portENTER_CRITICAL(&sharesMux)
+#define SHARES_UNLOCK() portEXIT_CRITICAL(&sharesMux)
+#else
+// Miner and network share the loop task
+#define SHARES_LOCK()
+#define SHARES_UNLOCK()
+#endif
 
 // Back-pressure & correlation for submits
 static volatile bool g_waitingSubmitResp = false;
@@ -46,7 +107,96 @@ const uint32_t QUIET_LOG_MS = 60000; // throttle idle logs
 // Optional: quick telemetry to detect bursts of low-diff rejects
 static uint16_t g_consecutiveLowDiff = 0;
 
-static void restart_handshake(const char* why);
+// Connection state machine
+static NetworkState networkState = NETWORK_DISCONNECTED;
+static uint32_t networkStateSinceMs = 0;
+static uint32_t networkRetryAtMs = 0;
+static uint8_t networkFailures = 0;
+static IPAddress poolAddresses[RESOLVER_MAX_ADDRESSES];
+static uint8_t poolAddressCount = 0;
+static IPAddress poolAddress; // the one connected to
+static uint32_t poolConnectStartMs = 0;
+
+// Failover & latency probing
+static std::string primaryPrevhash = "";
+static uint16_t g_consecutiveRejects = 0;
+static uint64_t probeId = 0;
+static uint32_t probeSentMs = 0;
+
+// Pool the current session was obtained from, only that one can resume it
+static int sessionPool = -1;
+
+// Client side vardiff: last suggested difficulty and when it was evaluated
+static double suggestedDifficulty = 0;
+static uint32_t vardiffCheckedMs = 0;
+// Difficulty of the session before the restart, suggested until a hashrate is known
+static double resumedDifficulty = 0;
+static uint32_t snapshotMs = 0;
+// Set from any task by network_requestRestart(), acted upon by network_listen()
+static const char *volatile restartReason = nullptr;
+
+// Outbound lines of the current tick, written to the socket at once by network_flush()
+static char txBuffer[NETWORK_TX_BUFFER_SIZE];
+static size_t txLength = 0;
+static NetworkTxStats txStats;
+// Submits in txBuffer, stamped with the time they leave by network_flush()
+static uint64_t txSubmitIds[NETWORK_TX_SUBMITS];
+static uint8_t txSubmitCount = 0;
+static uint32_t shareSweepMs = 0;
+
+// Bumped on every new job, shares found on an older one are late when rejected
+static uint32_t jobGeneration = 0;
+
+/**
+ * A share meeting the network target. It skips the submit back-pressure and queue and is
+ * resent after every reconnect that resumes the session, until answered or its prevhash is gone.
+ * Filled by the miner tasks and sent by the network task: plain data, only touched under
+ * SHARES_LOCK(), the network task works on copies.
+ */
+struct BlockCandidate
+{
+    bool pending;
+    uint32_t serial;    // bumped whenever a miner fills the slot
+    uint64_t requestId; // 0 while not sent on the current session
+    char job_id[NETWORK_JOB_ID_SIZE];
+    char extranonce2[NETWORK_EXTRANONCE2_SIZE];
+    char ntime[9];
+    uint32_t nonce;
+    char prevhash[65];
+};
+static BlockCandidate blockCandidates[NETWORK_BLOCK_CANDIDATES];
+static NetworkBlockStats blockStats; // under SHARES_LOCK()
+// primaryPrevhash for the miner tasks, under SHARES_LOCK()
+static char blockPrevhash[65] = "";
+
+// Newest non clean notify of the current burst, built by network_commitNotify() once the burst is read
+static Notification *stagedNotify = nullptr;
+
+// In-process pool replacing the socket (mock pool, replay), see network_setLoopback()
+static NetworkLoopback networkLoopback = nullptr;
+
+void subscribe();
+void authorize();
+void difficulty();
+void extranonceSubscribe();
+void request(const char *payload);
+void response(std::string r);
+static void network_discardTx();
+static void network_requestSubmit(uint64_t submitId, const char *payload);
+static void network_dropNotify();
+static void network_dropBlocks(const char *why);
+static void network_submitBlocks();
+static void network_dropQueued();
+static void network_setPrimaryPrevhash(const std::string &prevhash);
+void network_submit_all();
+
+/**
+ * @return true if the active pool speaks Stratum V2.
+ */
+static bool network_isV2()
+{
+    return pool_get(pool_getActive()).protocol == POOL_STRATUM_V2;
+}
 
 // helper: detect common "share accepted" replies from pools (NOMP, Miningcore, etc.)
 // static bool is_share_accepted(const std::string& r) {
@@ -72,66 +222,466 @@ uint64_t nextId()
 }
 
 /**
- * Checks if the device is connected to the network.
+ * Allocates the id of a new request and registers it, so that its response is routed by id.
  *
- * @note This function requires the configuration to be set.
+ * @param method What is asked.
+ * @param context Method specific data handed back with the response.
+ * @param sent_ms When it was asked, for a share when it was found.
  */
-short isConnected()
+static uint64_t network_requestId(StratumMethod method, uint32_t context = 0, uint32_t sent_ms = millis())
 {
-    if (WiFi.status() == WL_CONNECTED && client.connected())
+    const uint64_t requestId = nextId();
+    stratum_track(requestId, method, context, sent_ms);
+    return requestId;
+}
+
+static const char *network_stateName(NetworkState state)
+{
+    switch (state)
     {
-        return 1;
+    case NETWORK_DISCONNECTED:
+        return "disconnected";
+    case NETWORK_WIFI_JOINING:
+        return "wifi-joining";
+    case NETWORK_DNS:
+        return "dns";
+    case NETWORK_TCP_CONNECTING:
+        return "tcp-connecting";
+    case NETWORK_SUBSCRIBING:
+        return "subscribing";
+    case NETWORK_AUTHORIZED:
+        return "authorized";
+    }
+    return "unknown";
+}
+
+static void network_setState(NetworkState state)
+{
+    if (state == networkState)
+    {
+        return;
     }
+    l_debug(TAG_NETWORK, "State: %s -> %s", network_stateName(networkState), network_stateName(state));
+    networkState = state;
+    networkStateSinceMs = millis();
+    if (state == NETWORK_DNS)
+    {
+        boot_end(BOOT_WIFI);
+    }
+}
 
-    uint16_t wifi_attemps = 0;
+static bool network_failover(const char *why);
 
-    // check if we are already connected to WiFi
-    while (wifi_attemps < NETWORK_WIFI_ATTEMPTS)
+/**
+ * Records a failed connection step and schedules the next attempt with exponential backoff.
+ *
+ * @param why The reason of the failure, used for logging.
+ */
+static void network_fail(const char *why)
+{
+    // A warm standby makes the switch instant, no backoff needed
+    if (network_failover(why))
     {
-        l_info(TAG_NETWORK, "Connecting to %s...", configuration.wifi_ssid.c_str());
-        WiFi.begin(configuration.wifi_ssid.c_str(), configuration.wifi_password.c_str());
-        wifi_attemps++;
-        delay(500);
-        if (WiFi.waitForConnectResult() == WL_CONNECTED)
+        return;
+    }
+
+    pool_recordFailure(pool_getActive());
+
+    uint32_t backoff = NETWORK_BACKOFF_MIN_MS << (networkFailures < 6 ? networkFailures : 6);
+    if (backoff > NETWORK_BACKOFF_MAX_MS)
+    {
+        backoff = NETWORK_BACKOFF_MAX_MS;
+    }
+    if (networkFailures < UINT8_MAX)
+    {
+        networkFailures++;
+    }
+    l_error(TAG_NETWORK, "%s (attempt %d) - retry in %u ms", why, networkFailures, backoff);
+    client->stop();
+
+    // Move on to the next configured pool after repeated failures on this one
+    if (pool_count() > 1 && networkFailures % NETWORK_POOL_ATTEMPTS == 0)
+    {
+        pool_setActive((pool_getActive() + 1) % pool_count());
+        standby_reset();
+    }
+
+    networkRetryAtMs = millis() + backoff;
+    network_setState(NETWORK_DISCONNECTED);
+}
+
+/**
+ * Starts the stratum handshake on a freshly opened link.
+ */
+static void network_handshake()
+{
+    network_discardTx();
+    network_dropNotify();
+    SHARES_LOCK();
+    for (BlockCandidate &candidate : blockCandidates)
+    {
+        candidate.requestId = 0;
+    }
+    SHARES_UNLOCK();
+    isSubscribed = 0;
+    isAuthorized = 0;
+    inputLine = "";
+    lastRxMs = millis();
+    network_setState(NETWORK_SUBSCRIBING);
+
+    const PoolEndpoint &pool = pool_get(pool_getActive());
+    if (pool.protocol == POOL_STRATUM_V2)
+    {
+        network_dropQueued(); // SV2 shares belong to the channel of the previous socket
+        sv2_handshake(*client, pool.url.c_str(), pool.port);
+        return;
+    }
+    // The whole handshake leaves in one segment
+    subscribe();
+    authorize();
+    extranonceSubscribe();
+    difficulty();
+    network_flush();
+}
+
+/**
+ * Advances the connection state machine by one step.
+ *
+ * disconnected -> wifi-joining -> dns -> tcp-connecting -> subscribing -> authorized
+ *
+ * Every state has its own timeout; failures fall back to disconnected and the next
+ * attempt is delayed with an exponential backoff, so the caller can keep hashing the
+ * current job while the link recovers. WiFi, DNS and the pool replies are polled across
+ * ticks. The TCP connect and the TLS handshake are not: the cores only do them in one
+ * blocking call, bounded by NETWORK_TCP_TIMEOUT_MS and TLS_TIMEOUT_MS.
+ */
+static void network_step()
+{
+    const uint32_t now = millis();
+
+    // An in-process pool needs neither WiFi nor a socket
+    if (networkLoopback != nullptr)
+    {
+        if (networkState == NETWORK_DISCONNECTED && (int32_t)(now - networkRetryAtMs) >= 0)
         {
-            break;
+            network_handshake();
+        }
+        else if (networkState == NETWORK_SUBSCRIBING && network_isV2() && sv2_isRefused())
+        {
+            network_fail("Stratum V2 handshake refused");
         }
-        delay(1500);
+        else if (networkState == NETWORK_SUBSCRIBING && (network_isV2() ? sv2_isReady() : (isSubscribed == 1 && isAuthorized == 1)))
+        {
+            networkFailures = 0;
+            network_setState(NETWORK_AUTHORIZED);
+            network_submit_all();
+        }
+        return;
     }
 
-    if (WiFi.waitForConnectResult() != WL_CONNECTED)
+    // Losing WiFi invalidates every state past the association
+    if (networkState > NETWORK_WIFI_JOINING && WiFi.status() != WL_CONNECTED)
     {
-        l_error(TAG_NETWORK, "Unable to connect to WiFi");
-        return -1;
+        network_fail("WiFi connection lost");
+        return;
+    }
+
+    // A dropped socket invalidates the stratum session
+    if (networkState >= NETWORK_SUBSCRIBING && !client->connected())
+    {
+        network_fail("Pool connection lost");
+        return;
     }
 
-    l_info(TAG_NETWORK, "Connected to WiFi");
-    l_info(TAG_NETWORK, "IP address: %s", WiFi.localIP().toString().c_str());
-    l_info(TAG_NETWORK, "MAC address: %s", WiFi.macAddress().c_str());
+    switch (networkState)
+    {
+    case NETWORK_DISCONNECTED:
+        if ((int32_t)(now - networkRetryAtMs) < 0)
+        {
+            return;
+        }
+        if (WiFi.status() == WL_CONNECTED)
+        {
+            network_setState(NETWORK_DNS);
+            return;
+        }
+        l_info(TAG_NETWORK, "Connecting to %s...", configuration.wifi_ssid.c_str());
+        WiFi.begin(configuration.wifi_ssid.c_str(), configuration.wifi_password.c_str());
+        network_setState(NETWORK_WIFI_JOINING);
+        return;
 
-    uint16_t wifi_stratum = 0;
+    case NETWORK_WIFI_JOINING:
+        if (WiFi.status() == WL_CONNECTED)
+        {
+            l_info(TAG_NETWORK, "Connected to WiFi");
+            l_info(TAG_NETWORK, "IP address: %s", WiFi.localIP().toString().c_str());
+            l_info(TAG_NETWORK, "MAC address: %s", WiFi.macAddress().c_str());
+            network_setState(NETWORK_DNS);
+        }
+        else if (now - networkStateSinceMs > NETWORK_WIFI_TIMEOUT_MS)
+        {
+            network_fail("Unable to connect to WiFi");
+        }
+        return;
 
-    // and we are connected to the host
-    while (wifi_stratum < NETWORK_STRATUM_ATTEMPTS)
+    case NETWORK_DNS:
     {
-        l_debug(TAG_NETWORK, "Connecting to host %s...", configuration.pool_url.c_str());
-        client.connect(configuration.pool_url.c_str(), configuration.pool_port);
-        delay(500);
-        if (client.connected())
+        if (pool_count() == 0)
         {
-            break;
+            pool_setup(configuration);
         }
-        wifi_stratum++;
-        delay(1000);
+        const PoolEndpoint &pool = pool_get(pool_getActive());
+        const int count = resolver_poll(pool.url.c_str(), poolAddresses);
+        if (count < 0)
+        {
+            // The query is in flight, look again on the next tick
+            return;
+        }
+        poolAddressCount = count;
+        if (poolAddressCount == 0)
+        {
+            network_fail("Unable to resolve host");
+            return;
+        }
+        network_setState(NETWORK_TCP_CONNECTING);
+        return;
     }
 
-    if (!client.connected())
+    case NETWORK_TCP_CONNECTING:
     {
-        l_error(TAG_NETWORK, "Unable to connect to host");
-        return -1;
+        const PoolEndpoint &pool = pool_get(pool_getActive());
+        l_debug(TAG_NETWORK, "Connecting to host %s (%u address(es))...", pool.url.c_str(), poolAddressCount);
+        // Arduino cores have no asynchronous connect: on ESP8266 this blocks the loop for up
+        // to NETWORK_TCP_TIMEOUT_MS, on ESP32 only the network task waits
+        poolConnectStartMs = millis();
+        if (pool.tls)
+        {
+            // Blocks for up to TLS_TIMEOUT_MS, on ESP8266 the miner waits as long
+            client = &secureClient;
+            tls_connect(secureClient, pool.url.c_str(), poolAddresses, poolAddressCount, pool.port, poolAddress);
+        }
+        else
+        {
+            client = &plainClient;
+            const int index = resolver_connect(plainClient, pool.url.c_str(), poolAddresses, poolAddressCount, pool.port, NETWORK_TCP_TIMEOUT_MS);
+            poolAddress = index >= 0 ? poolAddresses[index] : IPAddress();
+        }
+        if (!client->connected())
+        {
+            network_fail("Unable to connect to host");
+            return;
+        }
+        if (pool.tls)
+        {
+            l_info(TAG_NETWORK, "TLS handshake with %s done in %u ms", pool.url.c_str(), millis() - poolConnectStartMs);
+        }
+        else
+        {
+            // The connect time is one round trip, good enough as first RTT sample
+            pool_recordRtt(pool_getActive(), millis() - poolConnectStartMs);
+        }
+#if defined(ESP32)
+        // The ESP32 TLS client keeps its own socket, the option only applies to plain ones
+        if (!pool.tls)
+#endif
+        {
+            // Writes are already coalesced per tick, Nagle would only hold shares back
+            client->setNoDelay(true);
+        }
+        network_handshake();
+        return;
     }
 
-    return 1;
+    case NETWORK_SUBSCRIBING:
+        if (network_isV2() ? sv2_isReady() : (isSubscribed == 1 && isAuthorized == 1))
+        {
+            networkFailures = 0;
+            pool_recordSuccess(pool_getActive());
+            probeSentMs = now;
+            network_setState(NETWORK_AUTHORIZED);
+            network_submitBlocks();
+            // Shares found while the link was down are still good on a resumed session
+            if (queuedShareCount > 0 && !network_isV2())
+            {
+                l_info(TAG_NETWORK, "Submitting %d shares queued while offline", queuedShareCount);
+                network_submit_all();
+            }
+        }
+        else if (network_isV2() && sv2_isRefused())
+        {
+            network_fail("Stratum V2 handshake refused");
+        }
+        else if (now - networkStateSinceMs > NETWORK_HANDSHAKE_TIMEOUT_MS)
+        {
+            network_fail("Stratum handshake timeout");
+        }
+        return;
+
+    case NETWORK_AUTHORIZED:
+        return;
+    }
+}
+
+/**
+ * Switches the primary session over to the warm standby, if there is one.
+ *
+ * @param why The reason of the switch, used for logging.
+ * @return true if the standby took over.
+ */
+static bool network_failover(const char *why)
+{
+    const int pool = standby_getPool();
+    if (pool < 0 || !standby_isReady())
+    {
+        return false;
+    }
+
+    l_error(TAG_NETWORK, "Failover to %s:%d - %s", pool_get(pool).url.c_str(), pool_get(pool).port, why);
+
+    g_waitingSubmitResp = false;
+    g_lastSubmitId = -1;
+    g_consecutiveRejects = 0;
+    probeId = 0;
+    network_dropQueued(); // queued shares belong to the previous session
+
+    pool_setActive(pool);
+    // The standby is always a plain socket
+    client->stop();
+    client = &plainClient;
+    standby_takeover(*client, inputLine);
+    network_discardTx();
+    network_dropNotify();
+    network_dropBlocks("failover to another pool");
+    sessionPool = pool;
+    jobGeneration++;
+    network_setPrimaryPrevhash("");
+
+    isSubscribed = 1;
+    isAuthorized = 1;
+    networkFailures = 0;
+    lastRxMs = millis();
+    probeSentMs = lastRxMs;
+    network_setState(NETWORK_AUTHORIZED);
+    return true;
+}
+
+/**
+ * Sends a latency probe on the primary session. mining.authorize is idempotent and answered by every pool.
+ */
+static void network_probe()
+{
+    char payload[1024];
+    probeId = network_requestId(STRATUM_PROBE);
+    probeSentMs = millis();
+    sprintf(payload, "{\"id\":%llu,\"method\":\"mining.authorize\",\"params\":[\"%s\",\"%s\"]}\n", probeId, configuration.wallet_address.c_str(), configuration.pool_password.c_str());
+    request(payload);
+}
+
+/**
+ * Checks if the device is connected to the network, advancing the connection state machine.
+ *
+ * @note This function requires the configuration to be set.
+ * @return 1 if the pool socket is up, 0 while connecting, -1 once NETWORK_CONNECT_ATTEMPTS consecutive attempts failed.
+ */
+short isConnected()
+{
+    network_step();
+
+    if (networkState >= NETWORK_SUBSCRIBING)
+    {
+        return 1;
+    }
+
+    return (networkFailures >= NETWORK_CONNECT_ATTEMPTS) ? -1 : 0;
+}
+
+/**
+ * Starts associating with WiFi without waiting for it, so that it overlaps the rest of the boot.
+ */
+void network_begin()
+{
+    boot_begin(BOOT_WIFI);
+    network_step();
+}
+
+NetworkState network_getState()
+{
+    return networkState;
+}
+
+/**
+ * Replaces the pool socket with an in-process Stratum V1 line transport, used to run
+ * the whole client against a mock pool. Outbound lines are handed to the loopback,
+ * inbound ones are fed with network_receive(). Passing nullptr restores the socket.
+ * A Stratum V2 pool also takes the frames with sv2_setLoopback() and feeds its own
+ * with network_receiveFrame().
+ *
+ * @param loopback The function receiving every outbound line.
+ */
+void network_setLoopback(NetworkLoopback loopback)
+{
+    networkLoopback = loopback;
+    isSubscribed = 0;
+    isAuthorized = 0;
+    networkFailures = 0;
+    networkRetryAtMs = millis();
+    network_setState(NETWORK_DISCONNECTED);
+}
+
+/**
+ * Handles one inbound stratum line as if it was read from the pool socket.
+ *
+ * @param line The line, without its trailing newline.
+ */
+void network_receive(const char *line)
+{
+    capture_record(CAPTURE_INBOUND, line, strlen(line));
+    lastRxMs = millis();
+    response(line);
+}
+
+/**
+ * Handles Stratum V2 bytes as if they were read from the pool socket.
+ */
+void network_receiveFrame(const uint8_t *data, size_t length)
+{
+    lastRxMs = millis();
+    sv2_receive(*client, data, length);
+}
+
+/**
+ * Sends a request of a capture being replayed again, under its recorded id, so that the
+ * recorded response finds it in the request table as it did at capture time.
+ *
+ * @param line The outbound line as recorded.
+ * @return The kind of request, STRATUM_UNKNOWN if the line is not one.
+ */
+StratumMethod network_replayRequest(const char *line)
+{
+    cJSON *json = cJSON_Parse(line);
+    const cJSON *idJson = cJSON_GetObjectItem(json, "id");
+    const cJSON *methodJson = cJSON_GetObjectItem(json, "method");
+    const StratumMethod method = cJSON_IsNumber(idJson) && cJSON_IsString(methodJson)
+                                     ? stratum_requestMethod(methodJson->valuestring)
+                                     : STRATUM_UNKNOWN;
+    const uint64_t requestId = method != STRATUM_UNKNOWN ? (uint64_t)idJson->valuedouble : 0;
+    cJSON_Delete(json);
+    if (method == STRATUM_UNKNOWN)
+    {
+        return STRATUM_UNKNOWN;
+    }
+
+    // A recorded share was found on the job replayed last, as it was when recorded
+    stratum_track(requestId, method, jobGeneration, millis());
+    if (method == STRATUM_SUBMIT)
+    {
+        network_requestSubmit(requestId, line);
+    }
+    else
+    {
+        request(line);
+    }
+    return method;
 }
 
 /**
@@ -145,14 +695,218 @@ short isConnected()
 //     l_info(TAG_NETWORK, ">>> %s", payload);
 // }
 
+/**
+ * Writes every line queued by request() since the last call, in a single socket write.
+ * Called once per network tick and right after the handshake.
+ */
+void network_flush()
+{
+    if (txLength == 0)
+    {
+        return;
+    }
+
+    txStats.writes++;
+    if (networkLoopback != nullptr)
+    {
+        // The loopback takes one line at a time
+        char *line = txBuffer;
+        char *end;
+        while ((end = (char *)memchr(line, '\n', txBuffer + txLength - line)) != nullptr)
+        {
+            *end = '\0';
+            networkLoopback(line);
+            line = end + 1;
+        }
+    }
+    else
+    {
+        PROBE_SCOPE(PROBE_SOCKET_WRITE);
+        client->write(reinterpret_cast<const uint8_t *>(txBuffer), txLength);
+    }
+    txStats.bytes += txLength;
+    txLength = 0;
+
+    const uint32_t now = millis();
+    for (uint8_t i = 0; i < txSubmitCount; i++)
+    {
+        stratum_written(txSubmitIds[i], now);
+    }
+    txSubmitCount = 0;
+}
+
+/**
+ * Drops the lines not written yet, when the socket they were meant for is gone.
+ */
+static void network_discardTx()
+{
+    txLength = 0;
+    txSubmitCount = 0;
+}
+
+/**
+ * Queues a share submit, its write time is recorded for the share lifecycle latencies.
+ */
+static void network_requestSubmit(uint64_t submitId, const char *payload)
+{
+    request(payload);
+    if (txSubmitCount < NETWORK_TX_SUBMITS)
+    {
+        txSubmitIds[txSubmitCount++] = submitId;
+    }
+}
+
+/**
+ * Gives up on the submits the pool never answered.
+ */
+static void network_sweepShares()
+{
+    if (millis() - shareSweepMs < NETWORK_SHARE_SWEEP_MS)
+    {
+        return;
+    }
+    shareSweepMs = millis();
+
+    StratumRequest expired;
+    while (stratum_takeExpired(STRATUM_SUBMIT, SHARES_ACK_TIMEOUT_MS, expired) ||
+           stratum_takeExpired(STRATUM_SUBMIT_BLOCK, SHARES_ACK_TIMEOUT_MS, expired))
+    {
+        l_error(TAG_NETWORK, "Submit %llu never %s", expired.id, expired.written_ms != 0 ? "answered" : "written");
+        shares_record(SHARE_TIMED_OUT, expired.sent_ms, expired.written_ms, 0);
+    }
+}
+
+/**
+ * Hands the session state to the flash snapshot, which batches the writes.
+ */
+static void network_snapshot()
+{
+    if (millis() - snapshotMs < NETWORK_SNAPSHOT_INTERVAL_MS)
+    {
+        return;
+    }
+    snapshotMs = millis();
+    if (networkState != NETWORK_AUTHORIZED || network_isV2() || networkLoopback != nullptr || current_subscribe == nullptr)
+    {
+        return;
+    }
+
+    const PoolEndpoint &pool = pool_get(pool_getActive());
+    SessionSnapshot snapshot;
+    snprintf(snapshot.host, sizeof(snapshot.host), "%s", pool.url.c_str());
+    snapshot.port = pool.port;
+    snapshot.address = (uint32_t)poolAddress;
+    snprintf(snapshot.session_id, sizeof(snapshot.session_id), "%s", current_subscribe->id.c_str());
+    snprintf(snapshot.extranonce1, sizeof(snapshot.extranonce1), "%s", current_subscribe->extranonce1.c_str());
+    snapshot.extranonce2_size = current_subscribe->extranonce2_size;
+    snapshot.difficulty = current_getDifficulty();
+    snapshot.accepted = current_get_hash_accepted();
+    snapshot.rejected = current_get_hash_rejected();
+    snapshot.best_difficulty = current_getHighestDifficulty();
+    session_update(snapshot);
+    session_loop();
+}
+
+/**
+ * Asks for a restart, safe to call from any task. The restart happens on the next
+ * network_listen(): the task writing the session snapshot and the lifetime log is the
+ * only one writing them.
+ *
+ * @param why The reason of the restart, used for logging.
+ */
+void network_requestRestart(const char *why)
+{
+    restartReason = why;
+}
+
+/**
+ * Saves the session snapshot and restarts, if asked to.
+ */
+static void network_restartIfRequested()
+{
+    const char *why = restartReason;
+    if (why == nullptr)
+    {
+        return;
+    }
+    l_error(TAG_NETWORK, "Restarting: %s", why);
+    snapshotMs = millis() - NETWORK_SNAPSHOT_INTERVAL_MS;
+    network_snapshot();
+    session_save();
+    lifetime_save();
+    ESP.restart();
+}
+
+/**
+ * Picks up the session snapshot of the previous boot, when it belongs to the active pool:
+ * its address skips DNS, its subscription is offered for resumption and its difficulty is
+ * the share target until the pool sends one.
+ */
+void network_resume()
+{
+    SessionSnapshot snapshot;
+    if (!session_load(snapshot))
+    {
+        return;
+    }
+
+    const PoolEndpoint &pool = pool_get(pool_getActive());
+    if (pool.url != snapshot.host || pool.port != snapshot.port || pool.protocol != POOL_STRATUM_V1)
+    {
+        l_info(TAG_NETWORK, "Snapshot of %s:%u does not match the pool, not resuming", snapshot.host, snapshot.port);
+        return;
+    }
+    // The counters are those of this pool, they carry over with its session
+    current_restoreStats(snapshot.accepted, snapshot.rejected, snapshot.best_difficulty);
+
+    if (snapshot.address != 0)
+    {
+        resolver_seed(snapshot.host, IPAddress(snapshot.address));
+    }
+    if (snapshot.session_id[0] != '\0')
+    {
+        current_setSubscribe(new Subscribe(snapshot.session_id, snapshot.extranonce1, snapshot.extranonce2_size));
+        sessionPool = pool_getActive();
+    }
+    if (snapshot.difficulty > 0)
+    {
+        current_setDifficulty(snapshot.difficulty);
+        resumedDifficulty = snapshot.difficulty;
+    }
+    l_info(TAG_NETWORK, "Resuming session %s on %s:%u, difficulty %.12g", snapshot.session_id, snapshot.host, snapshot.port, snapshot.difficulty);
+}
+
 void request(const char *payload)
 {
-    client.print(payload);
+    PROBE_SCOPE(PROBE_REQUEST);
     size_t len = strlen(payload);
-    if (len == 0 || payload[len - 1] != '\n') {
-        client.print('\n'); // enforce LF-terminated JSON line
-    }
+    capture_record(CAPTURE_OUTBOUND, payload, len);
     l_info(TAG_NETWORK, ">>> %s", payload);
+
+    const bool terminated = len > 0 && payload[len - 1] == '\n';
+    const size_t needed = len + (terminated ? 0 : 1); // enforce LF-terminated JSON line
+    if (txLength + needed > sizeof(txBuffer))
+    {
+        network_flush();
+        if (needed > sizeof(txBuffer))
+        {
+            l_error(TAG_NETWORK, "Request too big (%u bytes), dropped", needed);
+            return;
+        }
+    }
+
+    memcpy(txBuffer + txLength, payload, len);
+    txLength += len;
+    if (!terminated)
+    {
+        txBuffer[txLength++] = '\n';
+    }
+    txStats.lines++;
+}
+
+NetworkTxStats network_getTxStats()
+{
+    return txStats;
 }
 
 /**
@@ -161,24 +915,61 @@ void request(const char *payload)
 void authorize()
 {
     char payload[1024];
-    uint64_t next_id = nextId();
+    uint64_t next_id = network_requestId(STRATUM_AUTHORIZE);
     isAuthorized = 0;
-    authorizeId = next_id;
     sprintf(payload, "{\"id\":%llu,\"method\":\"mining.authorize\",\"params\":[\"%s\",\"%s\"]}\n", next_id, configuration.wallet_address.c_str(), configuration.pool_password.c_str());
     request(payload);
 }
 
+/**
+ * Asks the pool to notify extranonce changes with mining.set_extranonce instead of
+ * dropping the connection when it rebalances extranonce1.
+ */
+void extranonceSubscribe()
+{
+    char payload[128];
+    sprintf(payload, "{\"id\":%llu,\"method\":\"mining.extranonce.subscribe\",\"params\":[]}\n", network_requestId(STRATUM_EXTRANONCE_SUBSCRIBE));
+    request(payload);
+}
+
 /**
  * Subscribes to the mining service.
  * Generates a payload with the subscription details and sends it as a request.
+ * When reconnecting to the same pool, the previous session id is offered so the
+ * pool can resume it and keep our extranonce1 (and so the current job) valid.
  */
 void subscribe()
 {
     char payload[1024];
-    sprintf(payload, "{\"id\":%llu,\"method\":\"mining.subscribe\",\"params\":[\"LeafMiner/%s\", null]}\n", nextId(), _VERSION);
+    const char *sessionId = current_getSessionId();
+    if (sessionId != nullptr && sessionPool == (int)pool_getActive())
+    {
+        l_info(TAG_NETWORK, "Offering session %s for resumption", sessionId);
+        sprintf(payload, "{\"id\":%llu,\"method\":\"mining.subscribe\",\"params\":[\"LeafMiner/%s\", \"%s\"]}\n", network_requestId(STRATUM_SUBSCRIBE), _VERSION, sessionId);
+    }
+    else
+    {
+        sprintf(payload, "{\"id\":%llu,\"method\":\"mining.subscribe\",\"params\":[\"LeafMiner/%s\", null]}\n", network_requestId(STRATUM_SUBSCRIBE), _VERSION);
+    }
     request(payload);
 }
 
+/**
+ * Calculates the share difficulty to suggest to the pool, so that the measured hashrate
+ * yields the configured shares per minute. Falls back to the difficulty of the resumed session,
+ * else DIFFICULTY, until a hashrate is known.
+ */
+double network_suggestDifficulty()
+{
+    const double sharesPerMinute = configuration.shares_per_minute > 0 ? configuration.shares_per_minute : SHARES_PER_MINUTE;
+    const double diff = difficulty_for_share_rate(current_get_hashrate() * 1000.0, sharesPerMinute);
+    if (diff <= 0)
+    {
+        return resumedDifficulty > 0 ? resumedDifficulty : DIFFICULTY;
+    }
+    return diff < DIFFICULTY_MIN ? DIFFICULTY_MIN : diff;
+}
+
 /**
  * Suggests the mining difficulty for the network.
  * This function generates a payload string with the necessary data and sends it as a request.
@@ -186,65 +977,111 @@ void subscribe()
 void difficulty()
 {
     char payload[1024];
-    sprintf(payload, "{\"id\":%llu,\"method\":\"mining.suggest_difficulty\",\"params\":[%f]}\n", nextId(), DIFFICULTY);
+    suggestedDifficulty = network_suggestDifficulty();
+    vardiffCheckedMs = millis();
+    sprintf(payload, "{\"id\":%llu,\"method\":\"mining.suggest_difficulty\",\"params\":[%.12g]}\n", network_requestId(STRATUM_SUGGEST_DIFFICULTY), suggestedDifficulty);
     request(payload);
 }
 
 /**
- * Determines the response type based on the provided JSON document.
+ * Re-suggests the share difficulty when the hashrate moved enough to change the share rate
+ * by more than NETWORK_VARDIFF_RATIO, keeping the per-share overhead constant.
+ */
+static void network_vardiff()
+{
+    if (millis() - vardiffCheckedMs < NETWORK_VARDIFF_INTERVAL_MS)
+    {
+        return;
+    }
+    vardiffCheckedMs = millis();
+
+    const double diff = network_suggestDifficulty();
+    const double ratio = (suggestedDifficulty > 0) ? diff / suggestedDifficulty : 0;
+    if (ratio > 0 && ratio < NETWORK_VARDIFF_RATIO && ratio > 1.0 / NETWORK_VARDIFF_RATIO)
+    {
+        return;
+    }
+
+    l_info(TAG_NETWORK, "Vardiff: %.2f kH/s, suggesting difficulty %.12g (was %.12g)", current_get_hashrate(), diff, suggestedDifficulty);
+    difficulty();
+}
+
+/**
+ * Parses the result of a mining.subscribe response.
  *
- * @param doc The JSON document to analyze.
- * @return The response type as a const char*.
- *         Possible values are "subscribe", the value of the "method" key,
- *         "mining.submit" if the "result" key is true, "mining.submit.fail" if the "result" key is false,
- *         or "unknown" if none of the above conditions are met.
+ * @param json The whole response document.
+ * @return A new Subscribe owned by the caller, or nullptr if the result is malformed.
  */
-const char *responseType(cJSON *json)
+Subscribe *network_parseSubscribe(const cJSON *json)
 {
     const cJSON *result = cJSON_GetObjectItem(json, "result");
-    if (result != NULL && cJSON_IsArray(result) && cJSON_GetArraySize(result) > 0)
+    if (!cJSON_IsArray(result) || !cJSON_IsArray(cJSON_GetArrayItem(result, 0)) ||
+        !cJSON_IsArray(cJSON_GetArrayItem(cJSON_GetArrayItem(result, 0), 0)))
     {
-        const cJSON *item0 = cJSON_GetArrayItem(result, 0);
-        if (item0 != NULL && cJSON_IsArray(item0) && cJSON_GetArraySize(item0) > 0)
-        {
-            const cJSON *item00 = cJSON_GetArrayItem(item0, 0);
-            if (item00 != NULL && cJSON_IsArray(item00) && cJSON_GetArraySize(item00) > 0)
-            {
-                return "subscribe";
-            }
-        }
+        return nullptr;
     }
-    else if (cJSON_HasObjectItem(json, "method"))
+
+    const cJSON *subscribeIdJson = cJSON_GetArrayItem(cJSON_GetArrayItem(cJSON_GetArrayItem(result, 0), 0), 1);
+    const cJSON *extranonce1Json = cJSON_GetArrayItem(result, 1);
+    const cJSON *extranonce2SizeJson = cJSON_GetArrayItem(result, 2);
+
+    if (!cJSON_IsString(subscribeIdJson) || !cJSON_IsString(extranonce1Json) || !cJSON_IsNumber(extranonce2SizeJson))
     {
-        return cJSON_GetStringValue(cJSON_GetObjectItem(json, "method"));
+        return nullptr;
     }
-    else if (cJSON_HasObjectItem(json, "result"))
-    {
-        const cJSON *result = cJSON_GetObjectItem(json, "result");
-        if (authorizeId == cJSON_GetNumberValue(cJSON_GetObjectItem(json, "id")))
-        {
-            return "authorized";
-        }
-        if (cJSON_IsTrue(result))
-        {
-            return "mining.submit";
-        }
-        else
-        {
-            // Map error codes on submit
-            const cJSON *err = cJSON_GetObjectItem(json, "error");
-            int code = (cJSON_IsArray(err) && cJSON_GetArraySize(err) > 0)
-                    ? cJSON_GetNumberValue(cJSON_GetArrayItem(err, 0)) : 0;
-            switch (code) {
-                case 21: return "mining.submit.fail";                 // job not found
-                case 23: return "mining.submit.difficulty_too_low";   // diff too low
-                case 24: return "mining.unauthorized";                // worker lost auth
-                default: return "mining.submit.fail";                 // any other error = fail
-            }
+
+    return new Subscribe(subscribeIdJson->valuestring, extranonce1Json->valuestring, extranonce2SizeJson->valueint);
+}
+
+/**
+ * Parses and validates the params of a mining.notify message.
+ *
+ * @param params The params array of the notify.
+ * @return A new Notification owned by the caller, or nullptr if any field is missing or invalid.
+ */
+Notification *network_parseNotify(const cJSON *params)
+{
+    if (!cJSON_IsArray(params) || cJSON_GetArraySize(params) != 9) {
+        l_error(TAG_NETWORK, "notify: params missing/invalid");
+        return nullptr;
+    }
+    cJSON *jid = cJSON_GetArrayItem(params, 0);
+    if (!cJSON_IsString(jid) || !jid->valuestring) {
+        l_error(TAG_NETWORK, "notify: job_id missing/invalid");
+        return nullptr;
+    }
+
+    // Validate remaining fields and types
+    cJSON *prev = cJSON_GetArrayItem(params, 1);
+    cJSON *c1   = cJSON_GetArrayItem(params, 2);
+    cJSON *c2   = cJSON_GetArrayItem(params, 3);
+    cJSON *mb   = cJSON_GetArrayItem(params, 4);
+    cJSON *ver  = cJSON_GetArrayItem(params, 5);
+    cJSON *nb   = cJSON_GetArrayItem(params, 6);
+    cJSON *nt   = cJSON_GetArrayItem(params, 7);
+    cJSON *cln  = cJSON_GetArrayItem(params, 8);
+    if (!cJSON_IsString(prev) || !cJSON_IsString(c1) || !cJSON_IsString(c2) ||
+        !cJSON_IsArray(mb) || !cJSON_IsString(ver) || !cJSON_IsString(nb) ||
+        !cJSON_IsString(nt) || (!cJSON_IsBool(cln) && !cJSON_IsNumber(cln))) {
+        l_error(TAG_NETWORK, "notify: field types invalid");
+        return nullptr;
+    }
+
+    std::vector<std::string> merkleBranchStrings;
+    int merkleBranchSize = cJSON_GetArraySize(mb);
+    for (int i = 0; i < merkleBranchSize; ++i) {
+        cJSON *leaf = cJSON_GetArrayItem(mb, i);
+        if (!cJSON_IsString(leaf) || !leaf->valuestring) {
+            l_error(TAG_NETWORK, "notify: merkle branch item invalid");
+            return nullptr;
         }
+        merkleBranchStrings.emplace_back(leaf->valuestring);
     }
 
-    return "unknown";
+    bool clean_jobs = cJSON_IsBool(cln) ? cJSON_IsTrue(cln) : (cln->valueint == 1);
+
+    return new Notification(jid->valuestring, prev->valuestring, c1->valuestring, c2->valuestring, merkleBranchStrings,
+                            ver->valuestring, nb->valuestring, nt->valuestring, clean_jobs);
 }
 
 static void clear_wait_if_matching_submit(cJSON* json) {
@@ -255,220 +1092,369 @@ static void clear_wait_if_matching_submit(cJSON* json) {
     }
 }
 
-/**
- * @brief Handles the response received from the network.
- *
- * This function parses the response JSON and performs different actions based on the response type.
- * The response type determines how the response data is processed and stored.
- *
- */
-void response(std::string r)
+static void network_onSubscribe(const cJSON *json)
 {
-    cJSON *json = cJSON_Parse(r.c_str());
-    const char *type = responseType(json);
-    l_info(TAG_NETWORK, "<<< [%s] %s", type, r.c_str());
+    Subscribe *subscribe = network_parseSubscribe(json);
+    if (subscribe == nullptr)
+    {
+        l_error(TAG_NETWORK, "Invalid subscribe response");
+        return;
+    }
 
-    if (strcmp(type, "subscribe") == 0)
+    if (current_isSameSession(*subscribe))
     {
-        const cJSON *result = cJSON_GetObjectItem(json, "result");
-        if (cJSON_IsArray(result) && cJSON_IsArray(cJSON_GetArrayItem(result, 0)) &&
-            cJSON_IsArray(cJSON_GetArrayItem(cJSON_GetArrayItem(result, 0), 0)))
+        l_info(TAG_NETWORK, "Session %s resumed, keeping current job", subscribe->id.c_str());
+    }
+    else
+    {
+        if (queuedShareCount > 0)
         {
-            const cJSON *subscribeIdJson = cJSON_GetArrayItem(cJSON_GetArrayItem(cJSON_GetArrayItem(result, 0), 0), 1);
-            const cJSON *extranonce1Json = cJSON_GetArrayItem(result, 1);
-            const cJSON *extranonce2SizeJson = cJSON_GetArrayItem(result, 2);
-
-            if (cJSON_IsString(subscribeIdJson) && cJSON_IsString(extranonce1Json) && cJSON_IsNumber(extranonce2SizeJson))
-            {
-                std::string subscribeId = subscribeIdJson->valuestring;
-                std::string extranonce1 = extranonce1Json->valuestring;
-                int extranonce2_size = extranonce2SizeJson->valueint;
-                Subscribe *subscribe = new Subscribe(subscribeId, extranonce1, extranonce2_size);
-                current_setSubscribe(subscribe);
-            }
+            l_info(TAG_NETWORK, "Session not resumed, dropping %d queued shares", queuedShareCount);
+            network_dropQueued();
         }
+        network_dropBlocks("session not resumed");
     }
-    else if (strcmp(type, "mining.notify") == 0)
+    current_setSubscribe(subscribe);
+    sessionPool = pool_getActive();
+    isSubscribed = 1;
+}
+
+static void network_onAuthorize(const cJSON *json)
+{
+    if (!cJSON_IsTrue(cJSON_GetObjectItem(json, "result")))
     {
+        l_error(TAG_NETWORK, "Authorization refused");
+        return;
+    }
+    l_info(TAG_NETWORK, "Authorized");
+    isAuthorized = 1;
+}
 
-        // Don’t accept jobs before subscribe/session is set.
-        if (current_getSessionId() == nullptr) {
-            l_error(TAG_NETWORK, "Notify arrived before subscribe/session. Ignoring.");
-            cJSON_Delete(json); r.clear(); return;
-        }
+/**
+ * Turns a notify into the current job.
+ */
+static void network_applyNotify(Notification *notification)
+{
+    // fail fast check if job_id is the same as the current job
+    if (current_hasJob() && strcmp(current_job->job_id.c_str(), notification->job_id.c_str()) == 0)
+    {
+        l_error(TAG_NETWORK, "Job is the same as the current one");
+        delete notification;
+        return;
+    }
 
-        //cJSON *params = cJSON_GetObjectItem(json, "params");
-        //std::string job_id = cJSON_GetArrayItem(params, 0)->valuestring;
-        cJSON *params = cJSON_GetObjectItem(json, "params");
-        if (!cJSON_IsArray(params) || cJSON_GetArraySize(params) != 9) {
-            l_error(TAG_NETWORK, "notify: params missing/invalid");
-            cJSON_Delete(json); r.clear(); return;
-        }
-        cJSON *jid = cJSON_GetArrayItem(params, 0);
-        if (!cJSON_IsString(jid) || !jid->valuestring) {
-            l_error(TAG_NETWORK, "notify: job_id missing/invalid");
-            cJSON_Delete(json); r.clear(); return;
+    // A job announced again without clean_jobs is still retained, rebuilding it gains nothing
+    if (!notification->clean_jobs && current_findJob(notification->job_id) != nullptr)
+    {
+        l_debug(TAG_NETWORK, "Job %s is already retained", notification->job_id.c_str());
+        delete notification;
+        return;
+    }
+
+    // Reset stuck backpressure if a new clean_jobs notify arrives
+    if (notification->clean_jobs) {
+        if (g_waitingSubmitResp) {
+            l_info(TAG_NETWORK, "New clean job — dropping pending submit id=%lld", g_lastSubmitId);
+            g_waitingSubmitResp = false;
+            g_lastSubmitId = -1;
         }
-        std::string job_id = jid->valuestring;
+    }
+
+    // Track the chain tip seen by the primary, the standby compares against it
+    network_setPrimaryPrevhash(notification->prevhash);
+
+    jobGeneration++;
+
+    current_setJob(*notification);
+    delete notification;
+    isRequestingJob = 0;
+}
+
+static void network_dropNotify()
+{
+    delete stagedNotify;
+    stagedNotify = nullptr;
+}
+
+/**
+ * Builds the job of the notify staged during the burst just read, if any.
+ */
+void network_commitNotify()
+{
+    if (stagedNotify == nullptr)
+    {
+        return;
+    }
+    Notification *notification = stagedNotify;
+    stagedNotify = nullptr;
+    network_applyNotify(notification);
+}
+
+/**
+ * A notify with clean_jobs set is applied at once. Other ones only extend the work the
+ * miner already has, they are staged and only the newest of a burst is built into a job,
+ * sparing the merkle root and midstate work of the ones it supersedes.
+ */
+static void network_onNotify(const cJSON *json)
+{
+    // Don’t accept jobs before subscribe/session is set.
+    if (current_getSessionId() == nullptr) {
+        l_error(TAG_NETWORK, "Notify arrived before subscribe/session. Ignoring.");
+        return;
+    }
 
-        // fail fast check if job_id is the same as the current job
-        if (current_hasJob() && strcmp(current_job->job_id.c_str(), job_id.c_str()) == 0)
-        {
-            l_error(TAG_NETWORK, "Job is the same as the current one");
-            cJSON_Delete(json); r.clear(); 
-            return;
-        }        
-
-        // Validate remaining fields and types
-        cJSON *prev = cJSON_GetArrayItem(params, 1);
-        cJSON *c1   = cJSON_GetArrayItem(params, 2);
-        cJSON *c2   = cJSON_GetArrayItem(params, 3);
-        cJSON *mb   = cJSON_GetArrayItem(params, 4);
-        cJSON *ver  = cJSON_GetArrayItem(params, 5);
-        cJSON *nb   = cJSON_GetArrayItem(params, 6);
-        cJSON *nt   = cJSON_GetArrayItem(params, 7);
-        cJSON *cln  = cJSON_GetArrayItem(params, 8);
-        if (!cJSON_IsString(prev) || !cJSON_IsString(c1) || !cJSON_IsString(c2) ||
-            !cJSON_IsArray(mb) || !cJSON_IsString(ver) || !cJSON_IsString(nb) ||
-            !cJSON_IsString(nt) || (!cJSON_IsBool(cln) && !cJSON_IsNumber(cln))) {
-            l_error(TAG_NETWORK, "notify: field types invalid");
-            cJSON_Delete(json); r.clear(); return;
-        }
-
-        std::string prevhash = prev->valuestring;
-        std::string coinb1   = c1->valuestring;
-        std::string coinb2   = c2->valuestring;
-        std::string version  = ver->valuestring;
-        std::string nbits    = nb->valuestring;
-        std::string ntime    = nt->valuestring;
-        bool clean_jobs      = cJSON_IsBool(cln) ? cJSON_IsTrue(cln) : (cln->valueint == 1);
-
-        // Reset stuck backpressure if a new clean_jobs notify arrives
-        if (clean_jobs) {
-        if (g_waitingSubmitResp) {
-            l_info(TAG_NETWORK, "New clean job — dropping pending submit id=%lld", g_lastSubmitId);
-            g_waitingSubmitResp = false;
-            g_lastSubmitId = -1;
-        }
+    Notification *notification = network_parseNotify(cJSON_GetObjectItem(json, "params"));
+    if (notification == nullptr) {
+        return;
     }
 
-            
-        std::vector<std::string> merkleBranchStrings;
-        int merkleBranchSize = cJSON_GetArraySize(mb);
-        for (int i = 0; i < merkleBranchSize; ++i) {
-            cJSON *leaf = cJSON_GetArrayItem(mb, i);
-            if (!cJSON_IsString(leaf) || !leaf->valuestring) {
-                l_error(TAG_NETWORK, "notify: merkle branch item invalid");
-                cJSON_Delete(json); r.clear(); return;
-            }
-            merkleBranchStrings.emplace_back(leaf->valuestring);
-        }
+    if (stagedNotify != nullptr)
+    {
+        l_debug(TAG_NETWORK, "Job %s superseded by %s before being built", stagedNotify->job_id.c_str(), notification->job_id.c_str());
+        network_dropNotify();
+    }
 
-        requestJobId = nextId();
-            
-        current_setJob(Notification(job_id, prevhash, coinb1, coinb2, merkleBranchStrings,
-                                     version, nbits, ntime, clean_jobs));
-        isRequestingJob = 0;
+    if (notification->clean_jobs)
+    {
+        network_applyNotify(notification);
+        return;
     }
-    else if (strcmp(type, "mining.set_difficulty") == 0)
+    stagedNotify = notification;
+}
+
+static void network_onSetDifficulty(const cJSON *json)
+{
+    const cJSON *paramsArray = cJSON_GetObjectItem(json, "params");
+    if (cJSON_IsArray(paramsArray) && cJSON_GetArraySize(paramsArray) == 1)
     {
-        const cJSON *paramsArray = cJSON_GetObjectItem(json, "params");
-        if (cJSON_IsArray(paramsArray) && cJSON_GetArraySize(paramsArray) == 1)
+        const cJSON *difficultyItem = cJSON_GetArrayItem(paramsArray, 0);
+        if (cJSON_IsNumber(difficultyItem))
         {
-            const cJSON *difficultyItem = cJSON_GetArrayItem(paramsArray, 0);
-            if (cJSON_IsNumber(difficultyItem))
-            {
-                double diff = difficultyItem->valuedouble;
-                current_setDifficulty(diff);
-                l_debug(TAG_NETWORK, "Difficulty set to: %.10f", diff);
-            }
+            double diff = difficultyItem->valuedouble;
+            current_setDifficulty(diff);
+            l_debug(TAG_NETWORK, "Difficulty set to: %.10f", diff);
         }
     }
-    else if (strcmp(type, "authorized") == 0)
+}
+
+static void network_onSetExtranonce(const cJSON *json)
+{
+    const cJSON *paramsArray = cJSON_GetObjectItem(json, "params");
+    const cJSON *extranonce1Item = cJSON_GetArrayItem(paramsArray, 0);
+    const cJSON *extranonce2SizeItem = cJSON_GetArrayItem(paramsArray, 1);
+    if (cJSON_IsArray(paramsArray) && cJSON_IsString(extranonce1Item) && cJSON_IsNumber(extranonce2SizeItem))
+    {
+        // A notify staged earlier in the burst was sent for the old extranonce1, build it first
+        network_commitNotify();
+        // Applies from the next job on, the socket and the share pipeline stay as they are
+        current_setExtranonce(extranonce1Item->valuestring, extranonce2SizeItem->valueint);
+    }
+    else
     {
-        l_info(TAG_NETWORK, "Authorized");
-        isAuthorized = 1;
+        l_error(TAG_NETWORK, "set_extranonce: params missing/invalid");
     }
-    else if (strcmp(type, "mining.submit") == 0)
-    {               
-        clear_wait_if_matching_submit(json);
+}
+
+/**
+ * Handles the pool verdict on a share.
+ *
+ * @param json The response.
+ * @param request The submit it answers, its context is the job generation of the share.
+ */
+static void network_onSubmit(cJSON *json, const StratumRequest &request)
+{
+    clear_wait_if_matching_submit(json);
+    const uint32_t now = millis();
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "result")))
+    {
         Blink::getInstance().blink(BLINK_SUBMIT);
-        l_info(TAG_NETWORK, "Share accepted");
+        shares_record(SHARE_ACCEPTED, request.sent_ms, request.written_ms, now);
+        l_info(TAG_NETWORK, "Share accepted in %u ms", now - request.sent_ms);
         g_consecutiveLowDiff = 0;
+        g_consecutiveRejects = 0;
         current_increment_hash_accepted();
+        return;
     }
-    else if (strcmp(type, "mining.submit.difficulty_too_low") == 0)
+
+    const cJSON *err = cJSON_GetObjectItem(json, "error");
+    const int code = (cJSON_IsArray(err) && cJSON_GetArraySize(err) > 0)
+                         ? cJSON_GetNumberValue(cJSON_GetArrayItem(err, 0)) : 0;
+    switch (code)
     {
-         clear_wait_if_matching_submit(json);
+    case 23: // difficulty too low
         l_error(TAG_NETWORK, "Share rejected due to low difficulty");
+        shares_record(SHARE_LOW_DIFFICULTY, request.sent_ms, request.written_ms, now);
         current_increment_hash_rejected();
+        g_consecutiveRejects++;
         if (++g_consecutiveLowDiff >= 3) {
             // brief RX focus to catch any pending set_difficulty/notify
             uint32_t until = millis() + 100;
             while (millis() < until) network_listen();
             g_consecutiveLowDiff = 0;
         }
-    }    
+        return;
 
-    else if (strcmp(type, "mining.unauthorized") == 0) {
-        clear_wait_if_matching_submit(json);
+    case 24: // worker lost auth
         l_error(TAG_NETWORK, "Worker unauthorized by pool. Re-subscribing and re-authorizing.");
         isAuthorized = 0;
+        shares_record(SHARE_REJECTED, request.sent_ms, request.written_ms, now);
         current_increment_hash_rejected();   // don't count it as accepted
 
-        // Reset session so next getJob triggers a clean handshake
+        // Drop the socket, the state machine reconnects and re-handshakes
         g_waitingSubmitResp = false;
         g_lastSubmitId = -1;
+        isRequestingJob = 0;
         restart_handshake("unauthorized worker");
+        return;
 
-        // For ESP8266, also drop the socket so we start fresh
-    #if defined(ESP8266)
-        client.stop();
-    #endif
-        isRequestingJob = 0;
+    default: // 21 job not found, any other error is a plain reject
+        l_error(TAG_NETWORK, "Share rejected");
 
-        if (isConnected() == 1) {
-            // Proactively re-handshake now (optional but faster recovery)
-            isRequestingJob = 0; 
-            subscribe();
-            authorize();
-            difficulty();
+        // A share found on a previous job only says that job is gone
+        if (request.context != jobGeneration)
+        {
+            l_error(TAG_NETWORK, "Late responses, skip them");
+            shares_record(SHARE_STALE, request.sent_ms, request.written_ms, now);
+            current_increment_hash_stale();
+            return;
         }
+        shares_record(code == 21 ? SHARE_STALE : SHARE_REJECTED, request.sent_ms, request.written_ms, now);
 
-        return; // done with this response
+        current_job_is_valid = 0;
+#if defined(ESP32)
+        if (current_job_next != nullptr)
+        {
+            current_job = current_job_next;
+            current_job_next = nullptr;
+            current_job_is_valid = 1;
+            l_debug(TAG_NETWORK, "Job (next): %s ready to be mined", current_job->job_id.c_str());
+            current_increment_processedJob();
+        }
+#endif
+        current_increment_hash_rejected();
+        g_consecutiveRejects++;
+        return;
     }
-    else if (strcmp(type, "mining.submit.fail") == 0)
-    {
-        clear_wait_if_matching_submit(json);
-        l_error(TAG_NETWORK, "Share rejected");
+}
+
+/**
+ * Settles a block candidate, then accounts it as any other share. An unauthorized
+ * worker answer keeps it pending, it is resent once the session is authorized again.
+ */
+static void network_onSubmitBlock(cJSON *json, const StratumRequest &request)
+{
+    const bool accepted = cJSON_IsTrue(cJSON_GetObjectItem(json, "result"));
+    const cJSON *err = cJSON_GetObjectItem(json, "error");
+    const bool unauthorized = cJSON_IsArray(err) && cJSON_GetArraySize(err) > 0 &&
+                              cJSON_GetNumberValue(cJSON_GetArrayItem(err, 0)) == 24;
 
-        // prevent the current from requesting a new job, being old responses
-        if ((uint64_t)cJSON_GetObjectItem(json, "id")->valueint < requestJobId)
+    SHARES_LOCK();
+    for (BlockCandidate &candidate : blockCandidates)
+    {
+        if (candidate.pending && candidate.requestId == request.id)
         {
-            l_error(TAG_NETWORK, "Late responses, skip them");
+            candidate.requestId = 0;
+            candidate.pending = unauthorized;
         }
-        else
+    }
+    if (accepted)
+    {
+        blockStats.accepted++;
+    }
+    else if (!unauthorized)
+    {
+        blockStats.rejected++;
+    }
+    SHARES_UNLOCK();
+
+    if (accepted)
+    {
+        l_info(TAG_NETWORK, "Block candidate accepted in %u ms", millis() - request.sent_ms);
+    }
+    else if (!unauthorized)
+    {
+        l_error(TAG_NETWORK, "Block candidate rejected");
+    }
+    network_onSubmit(json, request);
+}
+
+/**
+ * @brief Handles the response received from the network.
+ *
+ * Pool notifications are dispatched on their method name, responses on the request
+ * they answer, looked up by id in the pending request table.
+ */
+void response(std::string r)
+{
+    PROBE_SCOPE(PROBE_RESPONSE);
+    cJSON *json = cJSON_Parse(r.c_str());
+    if (json == NULL)
+    {
+        l_error(TAG_NETWORK, "Invalid JSON: %s", r.c_str());
+        return;
+    }
+
+    const cJSON *methodJson = cJSON_GetObjectItem(json, "method");
+    if (cJSON_IsString(methodJson))
+    {
+        const StratumMethod method = stratum_method(methodJson->valuestring);
+        l_info(TAG_NETWORK, "<<< [%s] %s", methodJson->valuestring, r.c_str());
+
+        switch (method)
         {
-            current_job_is_valid = 0;
-#if defined(ESP32)
-            if (current_job_next != nullptr)
-            {
-                current_job = current_job_next;
-                current_job_next = nullptr;
-                current_job_is_valid = 1;
-                l_debug(TAG_NETWORK, "Job (next): %s ready to be mined", current_job->job_id.c_str());
-                current_increment_processedJob();
-            }
-#endif
-            current_increment_hash_rejected();
+        case STRATUM_NOTIFY:
+            network_onNotify(json);
+            break;
+        case STRATUM_SET_DIFFICULTY:
+            network_onSetDifficulty(json);
+            break;
+        case STRATUM_SET_EXTRANONCE:
+            network_onSetExtranonce(json);
+            break;
+        default:
+            l_error(TAG_NETWORK, "Unknown method: %s", methodJson->valuestring);
+            break;
         }
+        cJSON_Delete(json);
+        return;
     }
-    else
+
+    const cJSON *idJson = cJSON_GetObjectItem(json, "id");
+    StratumRequest request;
+    if (!cJSON_IsNumber(idJson) || !stratum_take((uint64_t)idJson->valuedouble, request))
     {
-        l_error(TAG_NETWORK, "Unknown response type: %s", type);
+        l_error(TAG_NETWORK, "<<< [unknown] %s", r.c_str());
+        cJSON_Delete(json);
+        return;
+    }
+    l_info(TAG_NETWORK, "<<< [%s] %s", stratum_methodName(request.method), r.c_str());
+
+    switch (request.method)
+    {
+    case STRATUM_SUBSCRIBE:
+        network_onSubscribe(json);
+        break;
+    case STRATUM_AUTHORIZE:
+        network_onAuthorize(json);
+        break;
+    case STRATUM_EXTRANONCE_SUBSCRIBE:
+        l_info(TAG_NETWORK, "Extranonce subscribe %s", cJSON_IsTrue(cJSON_GetObjectItem(json, "result")) ? "supported" : "not supported");
+        break;
+    case STRATUM_PROBE:
+        pool_recordRtt(pool_getActive(), millis() - request.sent_ms);
+        probeId = 0;
+        break;
+    case STRATUM_SUBMIT:
+        network_onSubmit(json, request);
+        break;
+    case STRATUM_SUBMIT_BLOCK:
+        network_onSubmitBlock(json, request);
+        break;
+    default:
+        break;
     }
     cJSON_Delete(json);
-    r.clear();
 }
 
 short network_getJob()
@@ -487,38 +1473,73 @@ short network_getJob()
 
     isRequestingJob = 1;
 
-    if (isConnected() == -1)
+    // Called at boot before the miners start, so waiting here costs no hashing
+    short status;
+    while ((status = isConnected()) == 0)
     {
-        g_waitingSubmitResp = false;
-        g_lastSubmitId = -1;
-        current_resetSession();        
-        return -1;
+        delay(10);
     }
 
-    if (current_getSessionId() == nullptr)
+    if (status == -1)
     {
-        subscribe();
-        authorize();
-        difficulty();
+        g_waitingSubmitResp = false;
+        g_lastSubmitId = -1;
+        current_resetSession();
+        return -1;
     }
 
     return 1;
 }
 
-void enqueue(const char *payload)
+/**
+ * Queues a share for network_submit_all(). Safe to call from the miner tasks.
+ */
+static void network_enqueue(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce)
 {
-    if (payloads_count < MAX_PAYLOADS)
+    if (job_id.size() >= NETWORK_JOB_ID_SIZE || extranonce2.size() >= NETWORK_EXTRANONCE2_SIZE ||
+        ntime.size() >= sizeof(QueuedShare::ntime))
+    {
+        l_error(TAG_NETWORK, "Share on job %s dropped, too long to queue", job_id.c_str());
+        return;
+    }
+
+    QueuedShare share;
+    memcpy(share.job_id, job_id.c_str(), job_id.size() + 1);
+    memcpy(share.extranonce2, extranonce2.c_str(), extranonce2.size() + 1);
+    memcpy(share.ntime, ntime.c_str(), ntime.size() + 1);
+    share.nonce = nonce;
+    share.generation = jobGeneration;
+    share.found_ms = millis();
+
+    bool queued = false;
+    SHARES_LOCK();
+    if (queuedShareCount < NETWORK_QUEUED_SHARES)
+    {
+        queuedShares[queuedShareCount++] = share;
+        queued = true;
+    }
+    SHARES_UNLOCK();
+
+    if (queued)
     {
-        strncpy(payloads[payloads_count], payload, MAX_PAYLOAD_SIZE - 1);
-        payloads_count++;
-        l_debug(TAG_NETWORK, "Payload queued: %s", payload);
+        l_debug(TAG_NETWORK, "Share queued on job %s", job_id.c_str());
     }
     else
     {
-        l_error(TAG_NETWORK, "Payload queue is full");
+        l_error(TAG_NETWORK, "Share queue is full");
     }
 }
 
+/**
+ * Forgets the queued shares, they belong to a session that is gone.
+ */
+static void network_dropQueued()
+{
+    SHARES_LOCK();
+    queuedShareCount = 0;
+    SHARES_UNLOCK();
+}
+
 // void network_send(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce)
 // {
 //     char payload[MAX_PAYLOAD_SIZE];
@@ -533,7 +1554,29 @@ void enqueue(const char *payload)
 
 void network_send(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce)
 {
+    PROBE_SCOPE(PROBE_SUBMIT);
+    if (network_isV2()) {
+#if defined(ESP32)
+        // The network task owns the socket and the channel state, it sends the share
+        network_enqueue(job_id, extranonce2, ntime, nonce);
+#else
+        // Standard channels submit nonce and ntime only, the channel dies with the socket
+        if (network_getState() == NETWORK_AUTHORIZED) {
+            sv2_send(*client, job_id, ntime, nonce, jobGeneration, millis());
+        } else {
+            l_error(TAG_NETWORK, "Share dropped, no SV2 channel open");
+        }
+#endif
+        return;
+    }
+
 #if defined(ESP8266)
+    // No session to submit on: keep the share, it is sent if the session gets resumed
+    if (network_getState() != NETWORK_AUTHORIZED) {
+        network_enqueue(job_id, extranonce2, ntime, nonce);
+        return;
+    }
+
     // Back-pressure: never queue a new submit until we got the reply to the last one
     if (g_waitingSubmitResp) {
         uint32_t now = millis();
@@ -547,70 +1590,265 @@ void network_send(const std::string &job_id, const std::string &extranonce2, con
     }
 
     char payload[MAX_PAYLOAD_SIZE];
-    uint64_t submitId = nextId();  // capture id so we can correlate the reply
+    uint64_t submitId = network_requestId(STRATUM_SUBMIT, jobGeneration);  // capture id so we can correlate the reply
     snprintf(payload, sizeof(payload),
              "{\"id\":%llu,\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%08x\"]}\n",
              submitId, configuration.wallet_address.c_str(), job_id.c_str(),
              extranonce2.c_str(), ntime.c_str(), nonce);    
 
-    request(payload);
+    network_requestSubmit(submitId, payload);
     // Immediately pump RX so we don’t fall behind
     network_listen();
     g_waitingSubmitResp = true;
     g_lastSubmitId      = (long long)submitId;
     g_submitSentAtMs    = millis();
 #else
-    // ESP32 path keeps the queue; can be left as-is or similarly guarded
-    char payload[MAX_PAYLOAD_SIZE];
-    uint64_t submitId = nextId();
-    snprintf(payload, sizeof(payload),
-             "{\"id\":%llu,\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%08x\"]}\n",
-             submitId, configuration.wallet_address.c_str(), job_id.c_str(),
-             extranonce2.c_str(), ntime.c_str(), nonce);
-    enqueue(payload);
+    // The network task owns the socket and the request table, it submits the share
+    network_enqueue(job_id, extranonce2, ntime, nonce);
 #endif
 }
 
-static void restart_handshake(const char* why) {
-    l_error(TAG_NETWORK, "Restarting handshake: %s", why ? why : "unknown");
+/**
+ * Submits a share meeting the network target at once, ahead of the back-pressure and
+ * the share queue. Without a session it is kept and sent as soon as one is back.
+ */
+void network_sendBlock(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce)
+{
+    if (network_isV2()) {
+        SHARES_LOCK();
+        blockStats.found++;
+        SHARES_UNLOCK();
+        // SV2 submits are never held back, the channel does not survive a reconnect anyway
+        network_send(job_id, extranonce2, ntime, nonce);
+        return;
+    }
+    PROBE_SCOPE(PROBE_SUBMIT);
 
-    // Kill any pending submit / backpressure
-    g_waitingSubmitResp = false;
-    g_lastSubmitId      = -1;
-    g_submitSentAtMs    = 0;
+    if (job_id.size() >= NETWORK_JOB_ID_SIZE || extranonce2.size() >= NETWORK_EXTRANONCE2_SIZE ||
+        ntime.size() >= sizeof(BlockCandidate::ntime)) {
+        l_error(TAG_NETWORK, "Block candidate on job %s dropped, too long to keep", job_id.c_str());
+        return;
+    }
 
-    // Nuke session & job
-    current_resetSession();  // clears subscribe & job state (your current.cpp already does this)
+    // Both slots busy only happens with two blocks within one outage, keep the newest
+    bool replaced = false;
+    SHARES_LOCK();
+    blockStats.found++;
+    BlockCandidate *slot = &blockCandidates[0];
+    for (BlockCandidate &candidate : blockCandidates) {
+        if (!candidate.pending) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (slot->pending) {
+        replaced = true;
+        blockStats.dropped++;
+    }
+    slot->pending = true;
+    slot->serial++;
+    slot->requestId = 0;
+    memcpy(slot->job_id, job_id.c_str(), job_id.size() + 1);
+    memcpy(slot->extranonce2, extranonce2.c_str(), extranonce2.size() + 1);
+    memcpy(slot->ntime, ntime.c_str(), ntime.size() + 1);
+    slot->nonce = nonce;
+    memcpy(slot->prevhash, blockPrevhash, sizeof(blockPrevhash));
+    SHARES_UNLOCK();
+
+    if (replaced) {
+        l_error(TAG_NETWORK, "Block candidate dropped, no free slot");
+    }
 
-    // Drop the socket so client.connected() won't lie
 #if defined(ESP8266)
-    client.stop();
-#else
-    client.stop();
+    network_submitBlocks();
 #endif
+    // ESP32: the network task sends it first thing on its next tick, it owns the socket
+}
 
-    // If we don't have a session, reconnect & handshake now
-    if (current_getSessionId() == nullptr) {
-        if (isConnected() == 1) {           // ensures WiFi + TCP connected (or reconnects)
-            subscribe();
-            authorize();
-            difficulty();
-            // Reset RX idle timer so we don't instantly trigger another restart
-            lastRxMs = millis();
-            // Also clear any partial line from previous socket
-            inputLine = "";
+NetworkBlockStats network_getBlockStats()
+{
+    SHARES_LOCK();
+    const NetworkBlockStats stats = blockStats;
+    SHARES_UNLOCK();
+    return stats;
+}
+
+/**
+ * @return The job generation, bumped by every job and every pool switch.
+ */
+uint32_t network_getJobGeneration()
+{
+    return jobGeneration;
+}
+
+/**
+ * Counts a new job that does not come from a notify, a Stratum V2 one.
+ */
+void network_bumpJobGeneration()
+{
+    jobGeneration++;
+}
+
+/**
+ * Records the chain tip of the primary, block candidates are stamped with it.
+ */
+static void network_setPrimaryPrevhash(const std::string &prevhash)
+{
+    primaryPrevhash = prevhash;
+    SHARES_LOCK();
+    strncpy(blockPrevhash, prevhash.c_str(), sizeof(blockPrevhash) - 1);
+    blockPrevhash[sizeof(blockPrevhash) - 1] = '\0';
+    SHARES_UNLOCK();
+}
+
+/**
+ * Sends every block candidate not sent yet on the current session, each in its own write.
+ */
+static void network_submitBlocks()
+{
+    if (network_getState() != NETWORK_AUTHORIZED || network_isV2())
+    {
+        return;
+    }
+
+    for (BlockCandidate &slot : blockCandidates)
+    {
+        BlockCandidate candidate;
+        SHARES_LOCK();
+        candidate = slot;
+        SHARES_UNLOCK();
+        if (!candidate.pending || candidate.requestId != 0)
+        {
+            continue;
+        }
+
+        // Once the chain moved on the candidate is worthless
+        const bool stale = !primaryPrevhash.empty() && primaryPrevhash != candidate.prevhash;
+        const uint64_t requestId = stale ? 0 : network_requestId(STRATUM_SUBMIT_BLOCK, jobGeneration);
+
+        // A miner may have refilled the slot meanwhile, it is then handled on the next call
+        SHARES_LOCK();
+        const bool same = slot.serial == candidate.serial;
+        if (same && stale)
+        {
+            slot.pending = false;
+            blockStats.dropped++;
+        }
+        else if (same)
+        {
+            slot.requestId = requestId;
+            blockStats.sent++;
+        }
+        SHARES_UNLOCK();
+        if (!same)
+        {
+            continue;
         }
+        if (stale)
+        {
+            l_error(TAG_NETWORK, "Block candidate on job %s dropped, prevhash is gone", candidate.job_id);
+            continue;
+        }
+
+        char payload[MAX_PAYLOAD_SIZE];
+        snprintf(payload, sizeof(payload),
+                 "{\"id\":%llu,\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%08x\"]}\n",
+                 requestId, configuration.wallet_address.c_str(), candidate.job_id,
+                 candidate.extranonce2, candidate.ntime, candidate.nonce);
+        l_info(TAG_NETWORK, "Submitting block candidate on job %s", candidate.job_id);
+        network_requestSubmit(requestId, payload);
+        network_flush();
+    }
+}
+
+static void network_dropBlocks(const char *why)
+{
+    for (BlockCandidate &slot : blockCandidates)
+    {
+        BlockCandidate candidate;
+        SHARES_LOCK();
+        candidate = slot;
+        if (slot.pending)
+        {
+            slot.pending = false;
+            blockStats.dropped++;
+        }
+        SHARES_UNLOCK();
+        if (candidate.pending)
+        {
+            l_error(TAG_NETWORK, "Block candidate on job %s dropped, %s", candidate.job_id, why);
+        }
+    }
+}
+
+void restart_handshake(const char* why) {
+    if (network_failover(why ? why : "unknown")) {
+        return;
     }
+
+    l_error(TAG_NETWORK, "Restarting handshake: %s", why ? why : "unknown");
+
+    // Kill any pending submit / backpressure
+    g_waitingSubmitResp = false;
+    g_lastSubmitId      = -1;
+    g_submitSentAtMs    = 0;
+
+    // Drop the socket so client.connected() won't lie; the current job keeps
+    // being mined while the state machine reconnects and re-handshakes.
+    client->stop();
+    isSubscribed = 0;
+    isAuthorized = 0;
+    inputLine = "";
+    network_setState(NETWORK_DISCONNECTED);
 }
 
 void network_listen()
-{    
-    if (isConnected() == -1) {
+{
+    network_restartIfRequested();
+    lifetime_loop();
+    trace_loop();
+    capture_loop();
+
+    if (isConnected() != 1) {
         g_waitingSubmitResp = false;
         g_lastSubmitId = -1;
-        current_resetSession();
+        yield();
         return;
     }
+    PROBE_SCOPE(PROBE_NETWORK_POLL);
+
+    if (networkState == NETWORK_AUTHORIZED) {
+#if defined(ESP32)
+        // Connecting the standby blocks for DNS and TCP, only the network task can afford it.
+        // On ESP8266 it would stall the miner sharing loop(), failover there uses the backoff path.
+        standby_loop();
+#endif
+
+        // Switch to the warm standby as soon as the primary looks worse than it
+        const uint32_t now = millis();
+        if (now - lastRxMs > NETWORK_FAILOVER_SILENCE_MS) {
+            network_failover("primary silent");
+        } else if (standby_isAhead(primaryPrevhash, NETWORK_FAILOVER_LAG_MS)) {
+            network_failover("primary lagging behind a new block");
+        } else if (g_consecutiveRejects >= NETWORK_FAILOVER_REJECTS) {
+            network_failover("primary keeps rejecting");
+        } else if (!g_waitingSubmitResp && pool_getActive() != 0 && standby_getPool() == 0 &&
+                   standby_getReadyMs() > NETWORK_FAILBACK_MS && !pool_isFaster(pool_getActive(), 0)) {
+            // Back to the configured primary once it held up for a while, unless the fallback is clearly faster
+            network_failover("primary pool is back");
+        } else if (!g_waitingSubmitResp && standby_getPool() >= 0 && pool_isFaster(standby_getPool(), pool_getActive())) {
+            network_failover("standby has lower latency");
+        }
+
+        // Latency probes and difficulty hints are Stratum V1 messages
+        if (!network_isV2()) {
+            if (probeId == 0 && now - probeSentMs > NETWORK_PROBE_INTERVAL_MS) {
+                network_probe();
+            }
+
+            network_vardiff();
+        }
+    }
 
     // In network_listen() or your main loop watchdog:
     if ((millis() - lastRxMs) > 60000) { // 60s of silence
@@ -641,14 +1879,22 @@ void network_listen()
 
     bool gotData = false;
 
+    if (network_isV2()) {
+        gotData = sv2_listen(*client);
+        if (gotData) {
+            lastRxMs = millis();
+        }
+    }
+
     // Drain everything that’s ready without blocking the hasher
-    while (client.available()) {
-        char c = client.read();
+    while (!network_isV2() && client->available()) {
+        char c = client->read();
         gotData = true;
 
         if (c == '\n') {
             if (inputLine.length() > 0) {
                 l_debug(TAG_NETWORK, "<<< len: %d", inputLine.length());
+                capture_record(CAPTURE_INBOUND, inputLine.c_str(), inputLine.length());
                 response(inputLine.c_str());
                 inputLine = "";
             }
@@ -668,43 +1914,65 @@ void network_listen()
         }
     }
 
+    // The socket is drained, the burst is over
+    network_commitNotify();
+    network_sweepShares();
+    network_snapshot();
+
+    // Everything queued during this tick leaves in one write
+    network_flush();
+
     // Keep Wi-Fi stack fed
     yield();    
 }
 
-void network_submit(const char *payload)
+/**
+ * Submits the oldest queued share.
+ *
+ * @return false if there is none, or no session to submit it on.
+ */
+static bool network_submitQueued()
 {
-    if (isConnected() == -1)
+    if (network_getState() != NETWORK_AUTHORIZED)
     {
-        g_waitingSubmitResp = false;
-        g_lastSubmitId = -1;
-        current_resetSession();
-        return; // Handle connection failure
+        return false; // Keep it queued until the session is back
     }
 
-    request(payload);
+    QueuedShare share;
+    SHARES_LOCK();
+    const bool queued = queuedShareCount > 0;
+    if (queued)
+    {
+        share = queuedShares[0];
+        queuedShareCount--;
+        memmove(&queuedShares[0], &queuedShares[1], queuedShareCount * sizeof(QueuedShare));
+    }
+    SHARES_UNLOCK();
+    if (!queued)
+    {
+        return false;
+    }
 
-    // Remove the submitted payload from the array
-    for (size_t i = 0; i < payloads_count; ++i)
+    if (network_isV2())
     {
-        if (strcmp(payloads[i], payload) == 0)
-        {
-            // Shift remaining payloads
-            for (size_t j = i; j < payloads_count - 1; ++j)
-            {
-                strcpy(payloads[j], payloads[j + 1]);
-            }
-            payloads_count--;
-            break;
-        }
+        sv2_send(*client, share.job_id, share.ntime, share.nonce, share.generation, share.found_ms);
+        return true;
     }
+
+    char payload[MAX_PAYLOAD_SIZE];
+    const uint64_t submitId = network_requestId(STRATUM_SUBMIT, share.generation, share.found_ms);
+    snprintf(payload, sizeof(payload),
+             "{\"id\":%llu,\"method\":\"mining.submit\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%08x\"]}\n",
+             submitId, configuration.wallet_address.c_str(), share.job_id, share.extranonce2, share.ntime, share.nonce);
+    network_requestSubmit(submitId, payload);
+    return true;
 }
 
 void network_submit_all()
 {
-    for (size_t i = 0; i < payloads_count; ++i)
+    network_submitBlocks();
+    while (network_submitQueued())
     {
-        network_submit(payloads[i]);
     }
 }
 
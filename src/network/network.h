@@ -2,9 +2,69 @@
 #define NETWORK_H
 #include <cJSON.h>
 #include <string>
-short isConnected(); 
+#include <stdint.h>
+#include "model/subscribe.h"
+#include "model/notification.h"
+#include "stratum.h"
+
+enum NetworkState : uint8_t
+{
+    NETWORK_DISCONNECTED,
+    NETWORK_WIFI_JOINING,
+    NETWORK_DNS,
+    NETWORK_TCP_CONNECTING,
+    NETWORK_SUBSCRIBING,
+    NETWORK_AUTHORIZED
+};
+
+/**
+ * Receives every outbound stratum line when the pool socket is replaced, see network_setLoopback().
+ */
+typedef void (*NetworkLoopback)(const char *line);
+
+struct NetworkTxStats
+{
+    uint32_t lines = 0;  // stratum requests sent
+    uint32_t writes = 0; // socket writes they were coalesced into
+    uint32_t bytes = 0;
+};
+
+/**
+ * Shares meeting the network target, counted apart from the ordinary ones.
+ */
+struct NetworkBlockStats
+{
+    uint32_t found = 0;
+    uint32_t sent = 0; // including resends after a reconnect
+    uint32_t accepted = 0;
+    uint32_t rejected = 0;
+    uint32_t dropped = 0; // stale prevhash or lost session before an answer
+};
+
+uint64_t nextId();
+double network_suggestDifficulty();
+short isConnected();
+void network_begin();
+void network_resume();
+void network_requestRestart(const char *why);
+NetworkState network_getState();
+Subscribe *network_parseSubscribe(const cJSON *json);
+Notification *network_parseNotify(const cJSON *params);
 short network_getJob();
 void network_send(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce);
+void network_sendBlock(const std::string &job_id, const std::string &extranonce2, const std::string &ntime, const uint32_t &nonce);
+NetworkBlockStats network_getBlockStats();
+uint32_t network_getJobGeneration();
+void network_bumpJobGeneration();
 void network_listen();
+void network_submit_all();
+void network_flush();
+NetworkTxStats network_getTxStats();
+void network_setLoopback(NetworkLoopback loopback);
+void network_receive(const char *line);
+void network_receiveFrame(const uint8_t *data, size_t length);
+StratumMethod network_replayRequest(const char *line);
+void network_commitNotify();
+void restart_handshake(const char *why);
 void networkTaskFunction(void *pvParameters);
 #endif // NETWORK_H
\ No newline at end of file
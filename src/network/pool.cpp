@@ -0,0 +1,210 @@
+#include <Arduino.h>
+#include <vector>
+#include "pool.h"
+#include "utils/log.h"
+
+#define POOL_BACKOFF_MIN_MS 5000
+#define POOL_BACKOFF_MAX_MS 300000
+#define POOL_RTT_MARGIN_MS 50
+
+#define POOL_SCHEME_V1 "stratum+tcp://"
+#define POOL_SCHEME_V2 "stratum2+tcp://"
+#define POOL_SCHEME_SSL "stratum+ssl://"
+#define POOL_SCHEME_TLS "stratum+tls://"
+
+char TAG_POOL[] = "Pool";
+static std::vector<PoolEndpoint> pools;
+static size_t activePool = 0;
+
+static bool pool_stripScheme(std::string &url, const char *scheme)
+{
+    if (url.rfind(scheme, 0) != 0)
+    {
+        return false;
+    }
+    url = url.substr(strlen(scheme));
+    return true;
+}
+
+/**
+ * Appends a pool, picking the transport from the optional URL scheme:
+ * "stratum2+tcp://" selects Stratum V2, "stratum+ssl://" or "stratum+tls://"
+ * Stratum V1 over TLS, no scheme or "stratum+tcp://" plain Stratum V1.
+ */
+static void pool_add(const std::string &url, int port)
+{
+    PoolProtocol protocol = POOL_STRATUM_V1;
+    bool tls = false;
+    std::string host = url;
+    if (pool_stripScheme(host, POOL_SCHEME_V2))
+    {
+        protocol = POOL_STRATUM_V2;
+    }
+    else if (pool_stripScheme(host, POOL_SCHEME_SSL) || pool_stripScheme(host, POOL_SCHEME_TLS))
+    {
+        tls = true;
+    }
+    else
+    {
+        pool_stripScheme(host, POOL_SCHEME_V1);
+    }
+
+    pools.emplace_back(host, port);
+    pools.back().protocol = protocol;
+    pools.back().tls = tls;
+}
+
+/**
+ * Builds the ordered pool list: the configured primary first, then every
+ * "host:port" entry of the comma separated pool_fallback setting.
+ *
+ * @param conf The configuration to read the pools from.
+ */
+void pool_setup(const Configuration &conf)
+{
+    pools.clear();
+    activePool = 0;
+    pool_add(conf.pool_url, conf.pool_port);
+
+    size_t start = 0;
+    const std::string &list = conf.pool_fallback;
+    while (start < list.length())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = list.length();
+        }
+
+        const std::string entry = list.substr(start, end - start);
+        const size_t colon = entry.rfind(':');
+        if (colon != std::string::npos && colon > 0)
+        {
+            const std::string url = entry.substr(0, colon);
+            const int port = atoi(entry.substr(colon + 1).c_str());
+            if (port > 0)
+            {
+                pool_add(url, port);
+                l_info(TAG_POOL, "Fallback pool #%d: %s:%d", pools.size() - 1, pools.back().url.c_str(), port);
+            }
+        }
+        else if (!entry.empty())
+        {
+            l_error(TAG_POOL, "Invalid fallback pool entry: %s", entry.c_str());
+        }
+        start = end + 1;
+    }
+}
+
+size_t pool_count()
+{
+    return pools.size();
+}
+
+PoolEndpoint &pool_get(size_t index)
+{
+    return pools[index];
+}
+
+size_t pool_getActive()
+{
+    return activePool;
+}
+
+void pool_setActive(size_t index)
+{
+    if (index < pools.size() && index != activePool)
+    {
+        l_info(TAG_POOL, "Active pool: %s:%d", pools[index].url.c_str(), pools[index].port);
+        activePool = index;
+    }
+}
+
+/**
+ * Feeds a round-trip sample into the smoothed RTT of a pool (EWMA, 1/4 weight).
+ */
+void pool_recordRtt(size_t index, uint32_t rtt_ms)
+{
+    PoolEndpoint &pool = pools[index];
+    pool.rtt_ms = (pool.rtt_ms == POOL_RTT_UNKNOWN) ? rtt_ms : (pool.rtt_ms * 3 + rtt_ms) / 4;
+    l_debug(TAG_POOL, "RTT %s: %u ms (sample %u ms)", pool.url.c_str(), pool.rtt_ms, rtt_ms);
+}
+
+void pool_recordFailure(size_t index)
+{
+    PoolEndpoint &pool = pools[index];
+    uint32_t backoff = POOL_BACKOFF_MIN_MS << (pool.failures < 6 ? pool.failures : 6);
+    if (backoff > POOL_BACKOFF_MAX_MS)
+    {
+        backoff = POOL_BACKOFF_MAX_MS;
+    }
+    if (pool.failures < UINT8_MAX)
+    {
+        pool.failures++;
+    }
+    pool.retry_at_ms = millis() + backoff;
+}
+
+void pool_recordSuccess(size_t index)
+{
+    pools[index].failures = 0;
+    pools[index].retry_at_ms = 0;
+}
+
+static bool pool_canStandby(size_t index, uint32_t now)
+{
+    // The standby session speaks plain Stratum V1 only
+    if (index == activePool || pools[index].protocol != POOL_STRATUM_V1 || pools[index].tls)
+    {
+        return false;
+    }
+    return pools[index].failures == 0 || (int32_t)(now - pools[index].retry_at_ms) >= 0;
+}
+
+/**
+ * Picks the pool to keep as hot standby. While a fallback pool is active that is the
+ * configured primary, so that mining can fail back to it. Otherwise the lowest known
+ * RTT among the pools that are not active and not backing off, unprobed pools in
+ * configured order.
+ *
+ * @return The pool index, or -1 if there is no candidate right now.
+ */
+int pool_selectStandby()
+{
+    const uint32_t now = millis();
+    if (!pools.empty() && pool_canStandby(0, now))
+    {
+        return 0;
+    }
+
+    int best = -1;
+    for (size_t i = 0; i < pools.size(); ++i)
+    {
+        if (!pool_canStandby(i, now))
+        {
+            continue;
+        }
+        if (best == -1 || pools[i].rtt_ms < pools[best].rtt_ms)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Checks whether a pool answers clearly faster than another one: both RTTs must be
+ * known and the candidate, plus POOL_RTT_MARGIN_MS, under half the reference, to avoid
+ * flapping between pools of similar latency.
+ */
+bool pool_isFaster(size_t candidate, size_t reference)
+{
+    const uint32_t a = pools[candidate].rtt_ms;
+    const uint32_t b = pools[reference].rtt_ms;
+    if (a == POOL_RTT_UNKNOWN || b == POOL_RTT_UNKNOWN)
+    {
+        return false;
+    }
+    return a + POOL_RTT_MARGIN_MS < b / 2;
+}
@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include "model/configuration.h"
+
+#define POOL_RTT_UNKNOWN UINT32_MAX
+
+enum PoolProtocol : uint8_t
+{
+    POOL_STRATUM_V1,
+    POOL_STRATUM_V2
+};
+
+struct PoolEndpoint
+{
+    std::string url;
+    int port;
+    PoolProtocol protocol = POOL_STRATUM_V1;
+    bool tls = false;
+    uint32_t rtt_ms = POOL_RTT_UNKNOWN;
+    uint8_t failures = 0;
+    uint32_t retry_at_ms = 0;
+
+    PoolEndpoint(const std::string &url, const int &port) : url(url), port(port)
+    {
+    }
+};
+
+void pool_setup(const Configuration &conf);
+size_t pool_count();
+PoolEndpoint &pool_get(size_t index);
+size_t pool_getActive();
+void pool_setActive(size_t index);
+void pool_recordRtt(size_t index, uint32_t rtt_ms);
+void pool_recordFailure(size_t index);
+void pool_recordSuccess(size_t index);
+int pool_selectStandby();
+bool pool_isFaster(size_t candidate, size_t reference);
+
+#endif // POOL_H
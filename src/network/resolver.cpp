@@ -0,0 +1,454 @@
+#include <Arduino.h>
+#include <string>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <lwip/dns.h>
+#else
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#endif // ESP8266
+#include "resolver.h"
+#include "utils/log.h"
+
+#define RESOLVER_DNS_TIMEOUT_MS 5000
+
+/**
+ * The addresses a pool host resolved to, best first: the one that won the last
+ * connect race is moved to the front.
+ */
+struct ResolverEntry
+{
+    std::string host = "";
+    IPAddress addresses[RESOLVER_MAX_ADDRESSES];
+    uint8_t count = 0;
+    uint32_t resolvedMs = 0;
+};
+
+#if defined(ESP8266)
+/**
+ * The DNS query in flight on ESP8266. lwIP answers from its own context between two
+ * loop() calls; the generation tells a late answer to an abandoned query apart.
+ */
+struct ResolverQuery
+{
+    std::string host = "";
+    uint32_t startMs = 0;
+    uint32_t generation = 0;
+    bool pending = false;
+    bool done = false;
+    IPAddress address;
+};
+#endif // ESP8266
+
+char TAG_RESOLVER[] = "Resolver";
+static ResolverEntry cache[RESOLVER_CACHE_SIZE];
+#if defined(ESP8266)
+static ResolverQuery query;
+#endif // ESP8266
+
+static ResolverEntry *resolver_find(const char *host)
+{
+    for (ResolverEntry &entry : cache)
+    {
+        if (entry.count > 0 && entry.host == host)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Queries every IPv4 address of a host. The ESP8266 core only hands out the first one,
+ * ESP32 returns as many as lwIP keeps per name.
+ */
+static uint8_t resolver_lookup(const char *host, IPAddress *addresses)
+{
+#if defined(ESP8266)
+    return WiFi.hostByName(host, addresses[0], RESOLVER_DNS_TIMEOUT_MS) == 1 ? 1 : 0;
+#else
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || result == nullptr)
+    {
+        return 0;
+    }
+
+    uint8_t count = 0;
+    for (struct addrinfo *info = result; info != nullptr && count < RESOLVER_MAX_ADDRESSES; info = info->ai_next)
+    {
+        addresses[count++] = IPAddress(reinterpret_cast<struct sockaddr_in *>(info->ai_addr)->sin_addr.s_addr);
+    }
+    freeaddrinfo(result);
+    return count;
+#endif
+}
+
+/**
+ * Copies the cached addresses of a host while its entry is fresh.
+ *
+ * @return The number of addresses, 0 if the host has to be resolved.
+ */
+static uint8_t resolver_cached(const char *host, IPAddress *addresses)
+{
+    const ResolverEntry *entry = resolver_find(host);
+    if (entry == nullptr || millis() - entry->resolvedMs >= RESOLVER_TTL_MS)
+    {
+        return 0;
+    }
+    for (uint8_t i = 0; i < entry->count; i++)
+    {
+        addresses[i] = entry->addresses[i];
+    }
+    return entry->count;
+}
+
+/**
+ * Caches the addresses a host resolved to: refreshes its entry, else takes the oldest one.
+ */
+static void resolver_store(const char *host, const IPAddress *addresses, uint8_t count, uint32_t now)
+{
+    ResolverEntry *entry = resolver_find(host);
+    if (entry == nullptr)
+    {
+        entry = &cache[0];
+        for (ResolverEntry &candidate : cache)
+        {
+            if (candidate.count == 0)
+            {
+                entry = &candidate;
+                break;
+            }
+            if (now - candidate.resolvedMs > now - entry->resolvedMs)
+            {
+                entry = &candidate;
+            }
+        }
+    }
+    entry->host = host;
+    entry->count = count;
+    entry->resolvedMs = now;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        entry->addresses[i] = addresses[i];
+    }
+}
+
+/**
+ * Resolves a host through the cache. Entries live RESOLVER_TTL_MS, the Arduino cores
+ * do not expose the record TTL, or until a connect to every address failed.
+ *
+ * @param host The host name.
+ * @param addresses Filled with up to RESOLVER_MAX_ADDRESSES addresses, best first.
+ * @return The number of addresses, 0 if the host could not be resolved.
+ */
+uint8_t resolver_resolve(const char *host, IPAddress *addresses)
+{
+    const uint32_t now = millis();
+    const uint8_t cached = resolver_cached(host, addresses);
+    if (cached > 0)
+    {
+        return cached;
+    }
+
+    const uint8_t count = resolver_lookup(host, addresses);
+    if (count == 0)
+    {
+        return 0;
+    }
+    l_debug(TAG_RESOLVER, "%s: %u address(es) in %u ms", host, count, millis() - now);
+    resolver_store(host, addresses, count, now);
+    return count;
+}
+
+#if defined(ESP8266)
+static void resolver_found(const char *name, const ip_addr_t *address, void *arg)
+{
+    if (!query.pending || (uint32_t)(uintptr_t)arg != query.generation)
+    {
+        return;
+    }
+    query.address = address != nullptr ? IPAddress(ip4_addr_get_u32(ip_2_ip4(address))) : IPAddress();
+    query.done = true;
+}
+#endif // ESP8266
+
+/**
+ * Resolves a host without waiting on DNS, to be called again until it settles. On
+ * ESP8266 the query goes to lwIP directly, the core's hostByName() would block the loop
+ * for up to RESOLVER_DNS_TIMEOUT_MS. On ESP32 the caller is the network task, the
+ * lookup just runs.
+ *
+ * @param host The host name.
+ * @param addresses Filled with up to RESOLVER_MAX_ADDRESSES addresses, best first.
+ * @return The number of addresses, 0 if the host could not be resolved, -1 while the
+ * query is in flight.
+ */
+int resolver_poll(const char *host, IPAddress *addresses)
+{
+#if defined(ESP8266)
+    const uint32_t now = millis();
+    if (!query.pending || query.host != host)
+    {
+        const uint8_t cached = resolver_cached(host, addresses);
+        if (cached > 0)
+        {
+            return cached;
+        }
+
+        query.host = host;
+        query.startMs = now;
+        query.generation++;
+        query.pending = true;
+        query.done = false;
+        ip_addr_t address;
+        const err_t result = dns_gethostbyname(host, &address, resolver_found, (void *)(uintptr_t)query.generation);
+        if (result == ERR_OK)
+        {
+            query.address = IPAddress(ip4_addr_get_u32(ip_2_ip4(&address)));
+            query.done = true;
+        }
+        else if (result != ERR_INPROGRESS)
+        {
+            query.pending = false;
+            return 0;
+        }
+    }
+
+    if (!query.done)
+    {
+        if (now - query.startMs < RESOLVER_DNS_TIMEOUT_MS)
+        {
+            return -1;
+        }
+        // lwIP may still answer, the generation makes it drop that
+        query.pending = false;
+        return 0;
+    }
+
+    query.pending = false;
+    if (!query.address.isSet())
+    {
+        return 0;
+    }
+    addresses[0] = query.address;
+    l_debug(TAG_RESOLVER, "%s: 1 address(es) in %u ms", host, now - query.startMs);
+    resolver_store(host, addresses, 1, now);
+    return 1;
+#else
+    return resolver_resolve(host, addresses);
+#endif // ESP8266
+}
+
+/**
+ * Caches an address known from a previous boot, so that the first connect skips DNS.
+ * A failing connect drops it like any cached entry.
+ */
+void resolver_seed(const char *host, const IPAddress &address)
+{
+    if (resolver_find(host) != nullptr)
+    {
+        return;
+    }
+    for (ResolverEntry &entry : cache)
+    {
+        if (entry.count == 0)
+        {
+            entry.host = host;
+            entry.addresses[0] = address;
+            entry.count = 1;
+            entry.resolvedMs = millis();
+            return;
+        }
+    }
+}
+
+/**
+ * Drops a host from the cache, its next resolve queries DNS again.
+ */
+void resolver_forget(const char *host)
+{
+    ResolverEntry *entry = resolver_find(host);
+    if (entry != nullptr)
+    {
+        entry->count = 0;
+    }
+}
+
+/**
+ * Moves the address that won a connect race to the front of the cached entry, so that
+ * the next reconnect tries it first.
+ */
+static void resolver_prefer(const char *host, const IPAddress &address)
+{
+    ResolverEntry *entry = resolver_find(host);
+    if (entry == nullptr)
+    {
+        return;
+    }
+    for (uint8_t i = 1; i < entry->count; i++)
+    {
+        if (entry->addresses[i] == address)
+        {
+            entry->addresses[i] = entry->addresses[0];
+            entry->addresses[0] = address;
+            return;
+        }
+    }
+}
+
+#if defined(ESP32)
+/**
+ * Opens a non-blocking connection to every address at once and keeps the first one
+ * that completes, happy eyeballs style.
+ *
+ * @return The connected socket, blocking again, or -1.
+ */
+static int resolver_race(const IPAddress *addresses, uint8_t count, uint16_t port, uint32_t timeout_ms, uint8_t &winner)
+{
+    int sockets[RESOLVER_MAX_ADDRESSES];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        sockets[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sockets[i] < 0)
+        {
+            continue;
+        }
+        fcntl(sockets[i], F_SETFL, fcntl(sockets[i], F_GETFL, 0) | O_NONBLOCK);
+
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = (uint32_t)addresses[i];
+        if (connect(sockets[i], reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 && errno != EINPROGRESS)
+        {
+            close(sockets[i]);
+            sockets[i] = -1;
+        }
+    }
+
+    int connected = -1;
+    const uint32_t start = millis();
+    while (connected < 0)
+    {
+        const uint32_t elapsed = millis() - start;
+        if (elapsed >= timeout_ms)
+        {
+            break;
+        }
+
+        fd_set writable;
+        FD_ZERO(&writable);
+        int highest = -1;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (sockets[i] >= 0)
+            {
+                FD_SET(sockets[i], &writable);
+                if (sockets[i] > highest)
+                {
+                    highest = sockets[i];
+                }
+            }
+        }
+        if (highest < 0)
+        {
+            break;
+        }
+
+        struct timeval remaining;
+        remaining.tv_sec = (timeout_ms - elapsed) / 1000;
+        remaining.tv_usec = ((timeout_ms - elapsed) % 1000) * 1000;
+        if (select(highest + 1, nullptr, &writable, nullptr, &remaining) <= 0)
+        {
+            break;
+        }
+
+        // Writable means the connect finished, successfully or not
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (sockets[i] < 0 || !FD_ISSET(sockets[i], &writable))
+            {
+                continue;
+            }
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(sockets[i], SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error == 0 && connected < 0)
+            {
+                connected = sockets[i];
+                winner = i;
+            }
+            else
+            {
+                close(sockets[i]);
+            }
+            sockets[i] = -1;
+        }
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (sockets[i] >= 0)
+        {
+            close(sockets[i]);
+        }
+    }
+    if (connected >= 0)
+    {
+        fcntl(connected, F_SETFL, fcntl(connected, F_GETFL, 0) & ~O_NONBLOCK);
+    }
+    return connected;
+}
+#endif // ESP32
+
+/**
+ * Connects to the first reachable address of a host. On ESP32 the attempts run in
+ * parallel; the ESP8266 core only connects by blocking, it tries the addresses in turn.
+ *
+ * @param client The client to connect.
+ * @param host The host the addresses belong to, its cache entry learns the winner.
+ * @param addresses The addresses from resolver_resolve(), best first.
+ * @param count The number of addresses.
+ * @param port The port to connect to.
+ * @param timeout_ms The time allowed to the whole attempt.
+ * @return The index of the connected address, -1 if none answered.
+ */
+int resolver_connect(WiFiClient &client, const char *host, const IPAddress *addresses, uint8_t count, uint16_t port, uint32_t timeout_ms)
+{
+    int winner = -1;
+#if defined(ESP8266)
+    client.setTimeout(timeout_ms / (count > 0 ? count : 1));
+    for (uint8_t i = 0; i < count && winner < 0; i++)
+    {
+        if (client.connect(addresses[i], port) && client.connected())
+        {
+            winner = i;
+        }
+    }
+#else
+    uint8_t index = 0;
+    const int connected = resolver_race(addresses, count, port, timeout_ms, index);
+    if (connected >= 0)
+    {
+        client = WiFiClient(connected);
+        winner = index;
+    }
+#endif
+
+    if (winner < 0)
+    {
+        // The host may have moved, query DNS again next time
+        resolver_forget(host);
+        return -1;
+    }
+    if (winner > 0)
+    {
+        l_debug(TAG_RESOLVER, "%s: %s answered first", host, addresses[winner].toString().c_str());
+        resolver_prefer(host, addresses[winner]);
+    }
+    return winner;
+}
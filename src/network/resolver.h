@@ -0,0 +1,19 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+#include <stdint.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif // ESP8266
+
+#define RESOLVER_MAX_ADDRESSES 4
+#define RESOLVER_CACHE_SIZE 4
+#define RESOLVER_TTL_MS 300000
+
+uint8_t resolver_resolve(const char *host, IPAddress *addresses);
+int resolver_poll(const char *host, IPAddress *addresses);
+int resolver_connect(WiFiClient &client, const char *host, const IPAddress *addresses, uint8_t count, uint16_t port, uint32_t timeout_ms);
+void resolver_seed(const char *host, const IPAddress &address);
+void resolver_forget(const char *host);
+#endif // RESOLVER_H
@@ -0,0 +1,112 @@
+#include <Arduino.h>
+#include <algorithm>
+#include "shares.h"
+#include "utils/log.h"
+
+/**
+ * The latest latencies of one lifecycle step, oldest overwritten first.
+ */
+struct ShareLatencies
+{
+    uint32_t samples[SHARES_LATENCY_SAMPLES] = {};
+    uint32_t written = 0;
+    uint64_t written_ms = 0; // sum of every sample, not only the kept ones
+};
+
+char TAG_SHARES[] = "Shares";
+static uint32_t outcomes[SHARE_OUTCOMES] = {};
+static ShareLatencies findToSend;
+static ShareLatencies sendToAck;
+
+static void shares_add(ShareLatencies &latencies, uint32_t ms)
+{
+    latencies.samples[latencies.written % SHARES_LATENCY_SAMPLES] = ms;
+    latencies.written_ms += ms;
+    latencies.written++;
+}
+
+static ShareLatencySummary shares_summarize(const ShareLatencies &latencies)
+{
+    ShareLatencySummary summary;
+    summary.total = latencies.written;
+    summary.total_ms = latencies.written_ms;
+    summary.count = latencies.written < SHARES_LATENCY_SAMPLES ? latencies.written : SHARES_LATENCY_SAMPLES;
+    if (summary.count == 0)
+    {
+        return summary;
+    }
+
+    uint32_t sorted[SHARES_LATENCY_SAMPLES];
+    std::copy(latencies.samples, latencies.samples + summary.count, sorted);
+    std::sort(sorted, sorted + summary.count);
+    summary.p50_ms = sorted[(summary.count - 1) * 50 / 100];
+    summary.p90_ms = sorted[(summary.count - 1) * 90 / 100];
+    summary.p99_ms = sorted[(summary.count - 1) * 99 / 100];
+    summary.max_ms = sorted[summary.count - 1];
+    return summary;
+}
+
+/**
+ * Records how a share ended and how long each step of its life took.
+ *
+ * @param outcome How the pool answered, or SHARE_TIMED_OUT.
+ * @param found_ms When miner() found it.
+ * @param written_ms When it was written to the socket, 0 if it never was.
+ * @param answered_ms When the answer arrived, ignored for timed out shares.
+ */
+void shares_record(ShareOutcome outcome, uint32_t found_ms, uint32_t written_ms, uint32_t answered_ms)
+{
+    outcomes[outcome]++;
+    if (written_ms == 0)
+    {
+        return;
+    }
+    shares_add(findToSend, written_ms - found_ms);
+    if (outcome != SHARE_TIMED_OUT)
+    {
+        shares_add(sendToAck, answered_ms - written_ms);
+    }
+    l_debug(TAG_SHARES, "Share %s: %u ms to send, %u ms to answer", shares_outcomeName(outcome), written_ms - found_ms,
+            outcome != SHARE_TIMED_OUT ? answered_ms - written_ms : 0);
+}
+
+uint32_t shares_count(ShareOutcome outcome)
+{
+    return outcomes[outcome];
+}
+
+const char *shares_outcomeName(ShareOutcome outcome)
+{
+    switch (outcome)
+    {
+    case SHARE_ACCEPTED:
+        return "accepted";
+    case SHARE_LOW_DIFFICULTY:
+        return "low_difficulty";
+    case SHARE_STALE:
+        return "stale";
+    case SHARE_REJECTED:
+        return "rejected";
+    case SHARE_TIMED_OUT:
+        return "timed_out";
+    case SHARE_OUTCOMES:
+        break;
+    }
+    return "unknown";
+}
+
+/**
+ * @return Percentiles of the time from finding a share to writing it to the socket.
+ */
+ShareLatencySummary shares_findToSend()
+{
+    return shares_summarize(findToSend);
+}
+
+/**
+ * @return Percentiles of the time from writing a share to the pool answer.
+ */
+ShareLatencySummary shares_sendToAck()
+{
+    return shares_summarize(sendToAck);
+}
@@ -0,0 +1,34 @@
+#ifndef SHARES_H
+#define SHARES_H
+#include <stdint.h>
+
+#define SHARES_LATENCY_SAMPLES 64 // latest shares the percentiles are computed on
+#define SHARES_ACK_TIMEOUT_MS 30000
+
+enum ShareOutcome : uint8_t
+{
+    SHARE_ACCEPTED,
+    SHARE_LOW_DIFFICULTY,
+    SHARE_STALE, // job replaced or unknown to the pool
+    SHARE_REJECTED,
+    SHARE_TIMED_OUT,
+    SHARE_OUTCOMES
+};
+
+struct ShareLatencySummary
+{
+    uint32_t count = 0; // samples the percentiles are computed on
+    uint32_t p50_ms = 0;
+    uint32_t p90_ms = 0;
+    uint32_t p99_ms = 0;
+    uint32_t max_ms = 0;
+    uint32_t total = 0; // every sample since boot
+    uint64_t total_ms = 0;
+};
+
+void shares_record(ShareOutcome outcome, uint32_t found_ms, uint32_t written_ms, uint32_t answered_ms);
+uint32_t shares_count(ShareOutcome outcome);
+const char *shares_outcomeName(ShareOutcome outcome);
+ShareLatencySummary shares_findToSend();
+ShareLatencySummary shares_sendToAck();
+#endif // SHARES_H
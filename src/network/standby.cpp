@@ -0,0 +1,403 @@
+#include <Arduino.h>
+#include <cJSON.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif // ESP8266
+#include "standby.h"
+#include "network.h"
+#include "pool.h"
+#include "resolver.h"
+#include "current.h"
+#include "leafminer.h"
+#include "utils/log.h"
+#include "model/configuration.h"
+
+#define STANDBY_TCP_TIMEOUT_MS 3000
+#define STANDBY_HANDSHAKE_TIMEOUT_MS 10000
+#define STANDBY_PROBE_INTERVAL_MS 60000
+#define STANDBY_SILENCE_TIMEOUT_MS 180000
+#define STANDBY_RETRY_MS 5000
+// A notify older than this is not built into a job on takeover, the pool has moved on
+#define STANDBY_JOB_STALE_MS 60000
+
+enum StandbyState : uint8_t
+{
+    STANDBY_IDLE,
+    STANDBY_SUBSCRIBING,
+    STANDBY_READY
+};
+
+/**
+ * A second, fully handshaken pool session kept warm next to the primary one.
+ * It tracks its own subscribe, difficulty and latest notify so that a failover
+ * only has to swap the socket and apply them.
+ */
+struct StandbySession
+{
+    WiFiClient client;
+    StandbyState state = STANDBY_IDLE;
+    int pool = -1;
+    String inputLine = "";
+    uint32_t stateSinceMs = 0;
+    uint32_t retryAtMs = 0;
+    uint32_t lastRxMs = 0;
+    uint64_t subscribeId = 0;
+    uint64_t authorizeId = 0;
+    uint64_t probeId = 0;
+    uint32_t probeSentMs = 0;
+    bool authorized = false;
+    Subscribe *subscribe = nullptr;
+    Notification *notification = nullptr;
+    uint32_t notifiedAtMs = 0;
+    double difficulty = 0;
+    std::string prevhash = "";
+    std::string previousPrevhash = "";
+    uint32_t prevhashAtMs = 0;
+};
+
+extern Configuration configuration;
+char TAG_STANDBY[] = "Standby";
+static StandbySession standby;
+
+static void standby_send(const char *payload)
+{
+    standby.client.print(payload);
+    l_debug(TAG_STANDBY, ">>> %s", payload);
+}
+
+/**
+ * Releases the session state, keeping the socket untouched.
+ */
+static void standby_clear()
+{
+    delete standby.subscribe;
+    standby.subscribe = nullptr;
+    delete standby.notification;
+    standby.notification = nullptr;
+    standby.authorized = false;
+    standby.difficulty = 0;
+    standby.inputLine = "";
+    standby.prevhash = "";
+    standby.previousPrevhash = "";
+    standby.state = STANDBY_IDLE;
+    standby.stateSinceMs = millis();
+}
+
+static void standby_fail(const char *why)
+{
+    l_error(TAG_STANDBY, "%s", why);
+    if (standby.pool >= 0)
+    {
+        pool_recordFailure(standby.pool);
+    }
+    standby.client.stop();
+    standby_clear();
+    standby.pool = -1;
+    standby.retryAtMs = millis() + STANDBY_RETRY_MS;
+}
+
+static void standby_connect()
+{
+    const int index = pool_selectStandby();
+    if (index < 0)
+    {
+        standby.retryAtMs = millis() + STANDBY_RETRY_MS;
+        return;
+    }
+
+    PoolEndpoint &pool = pool_get(index);
+    standby.pool = index;
+
+    IPAddress addresses[RESOLVER_MAX_ADDRESSES];
+    const uint8_t count = resolver_resolve(pool.url.c_str(), addresses);
+    if (count == 0)
+    {
+        standby_fail("Unable to resolve standby host");
+        return;
+    }
+
+    // The connect time is one round trip, good enough as first RTT sample
+    const uint32_t start = millis();
+    if (resolver_connect(standby.client, pool.url.c_str(), addresses, count, pool.port, STANDBY_TCP_TIMEOUT_MS) < 0)
+    {
+        standby_fail("Unable to connect to standby host");
+        return;
+    }
+    pool_recordRtt(index, millis() - start);
+    l_info(TAG_STANDBY, "Connected to %s:%d", pool.url.c_str(), pool.port);
+
+    char payload[512];
+    standby.subscribeId = nextId();
+    snprintf(payload, sizeof(payload), "{\"id\":%llu,\"method\":\"mining.subscribe\",\"params\":[\"LeafMiner/%s\", null]}\n", standby.subscribeId, _VERSION);
+    standby_send(payload);
+    standby.authorizeId = nextId();
+    snprintf(payload, sizeof(payload), "{\"id\":%llu,\"method\":\"mining.authorize\",\"params\":[\"%s\",\"%s\"]}\n", standby.authorizeId, configuration.wallet_address.c_str(), configuration.pool_password.c_str());
+    standby_send(payload);
+    snprintf(payload, sizeof(payload), "{\"id\":%llu,\"method\":\"mining.extranonce.subscribe\",\"params\":[]}\n", nextId());
+    standby_send(payload);
+    snprintf(payload, sizeof(payload), "{\"id\":%llu,\"method\":\"mining.suggest_difficulty\",\"params\":[%.12g]}\n", nextId(), network_suggestDifficulty());
+    standby_send(payload);
+
+    standby.lastRxMs = millis();
+    standby.state = STANDBY_SUBSCRIBING;
+    standby.stateSinceMs = millis();
+}
+
+/**
+ * Sends a latency probe. mining.authorize is idempotent and answered by every pool.
+ */
+static void standby_probe()
+{
+    char payload[512];
+    standby.probeId = nextId();
+    standby.probeSentMs = millis();
+    snprintf(payload, sizeof(payload), "{\"id\":%llu,\"method\":\"mining.authorize\",\"params\":[\"%s\",\"%s\"]}\n", standby.probeId, configuration.wallet_address.c_str(), configuration.pool_password.c_str());
+    standby_send(payload);
+}
+
+static void standby_response(const char *line)
+{
+    cJSON *json = cJSON_Parse(line);
+    if (json == NULL)
+    {
+        return;
+    }
+
+    const cJSON *method = cJSON_GetObjectItem(json, "method");
+    if (cJSON_IsString(method))
+    {
+        if (strcmp(method->valuestring, "mining.notify") == 0)
+        {
+            Notification *notification = network_parseNotify(cJSON_GetObjectItem(json, "params"));
+            if (notification != nullptr)
+            {
+                if (notification->prevhash != standby.prevhash)
+                {
+                    standby.previousPrevhash = standby.prevhash;
+                    standby.prevhash = notification->prevhash;
+                    standby.prevhashAtMs = millis();
+                }
+                delete standby.notification;
+                standby.notification = notification;
+                standby.notifiedAtMs = millis();
+            }
+        }
+        else if (strcmp(method->valuestring, "mining.set_difficulty") == 0)
+        {
+            const cJSON *params = cJSON_GetObjectItem(json, "params");
+            if (cJSON_IsArray(params) && cJSON_IsNumber(cJSON_GetArrayItem(params, 0)))
+            {
+                standby.difficulty = cJSON_GetArrayItem(params, 0)->valuedouble;
+            }
+        }
+        else if (strcmp(method->valuestring, "mining.set_extranonce") == 0 && standby.subscribe != nullptr)
+        {
+            const cJSON *params = cJSON_GetObjectItem(json, "params");
+            if (cJSON_IsArray(params) && cJSON_IsString(cJSON_GetArrayItem(params, 0)) && cJSON_IsNumber(cJSON_GetArrayItem(params, 1)))
+            {
+                standby.subscribe->extranonce1 = cJSON_GetArrayItem(params, 0)->valuestring;
+                standby.subscribe->extranonce2_size = cJSON_GetArrayItem(params, 1)->valueint;
+            }
+        }
+        cJSON_Delete(json);
+        return;
+    }
+
+    const cJSON *idJson = cJSON_GetObjectItem(json, "id");
+    const uint64_t id = cJSON_IsNumber(idJson) ? (uint64_t)idJson->valuedouble : 0;
+    if (id == standby.subscribeId)
+    {
+        delete standby.subscribe;
+        standby.subscribe = network_parseSubscribe(json);
+    }
+    else if (id == standby.authorizeId)
+    {
+        standby.authorized = cJSON_IsTrue(cJSON_GetObjectItem(json, "result"));
+    }
+    else if (id == standby.probeId && standby.pool >= 0)
+    {
+        pool_recordRtt(standby.pool, millis() - standby.probeSentMs);
+        standby.probeId = 0;
+    }
+
+    cJSON_Delete(json);
+}
+
+/**
+ * Advances the standby session by one non-blocking step.
+ * Does nothing unless more than one pool is configured.
+ */
+void standby_loop()
+{
+    if (pool_count() < 2 || WiFi.status() != WL_CONNECTED)
+    {
+        return;
+    }
+
+    const uint32_t now = millis();
+
+    if (standby.state == STANDBY_IDLE)
+    {
+        if ((int32_t)(now - standby.retryAtMs) >= 0)
+        {
+            standby_connect();
+        }
+        return;
+    }
+
+    if (!standby.client.connected())
+    {
+        standby_fail("Standby connection lost");
+        return;
+    }
+
+    while (standby.client.available())
+    {
+        char c = standby.client.read();
+        if (c == '\n')
+        {
+            if (standby.inputLine.length() > 0)
+            {
+                standby_response(standby.inputLine.c_str());
+                standby.inputLine = "";
+            }
+        }
+        else if (c != '\r')
+        {
+            standby.inputLine += c;
+        }
+        standby.lastRxMs = millis();
+    }
+
+    if (standby.state == STANDBY_SUBSCRIBING)
+    {
+        if (standby.subscribe != nullptr && standby.authorized)
+        {
+            l_info(TAG_STANDBY, "Ready on %s (session %s)", pool_get(standby.pool).url.c_str(), standby.subscribe->id.c_str());
+            pool_recordSuccess(standby.pool);
+            standby.state = STANDBY_READY;
+            standby.stateSinceMs = now;
+            standby.probeSentMs = now;
+        }
+        else if (now - standby.stateSinceMs > STANDBY_HANDSHAKE_TIMEOUT_MS)
+        {
+            standby_fail("Standby handshake timeout");
+        }
+        return;
+    }
+
+    if (now - standby.lastRxMs > STANDBY_SILENCE_TIMEOUT_MS)
+    {
+        standby_fail("Standby silent");
+        return;
+    }
+
+    // The primary pool is reachable again, keep it warm instead to fail back to it
+    if (standby.pool != 0 && pool_selectStandby() == 0)
+    {
+        l_info(TAG_STANDBY, "Switching the standby to the primary pool");
+        standby_reset();
+        return;
+    }
+
+    if (standby.probeId == 0 && now - standby.probeSentMs > STANDBY_PROBE_INTERVAL_MS)
+    {
+        standby_probe();
+    }
+}
+
+/**
+ * Drops the standby session, e.g. after the pool list changed.
+ */
+void standby_reset()
+{
+    standby.client.stop();
+    standby_clear();
+    standby.pool = -1;
+    standby.retryAtMs = 0;
+}
+
+bool standby_isReady()
+{
+    return standby.state == STANDBY_READY && standby.client.connected() && standby.notification != nullptr;
+}
+
+int standby_getPool()
+{
+    return standby.pool;
+}
+
+/**
+ * @return How long the standby has been ready, 0 if it is not.
+ */
+uint32_t standby_getReadyMs()
+{
+    return standby_isReady() ? millis() - standby.stateSinceMs : 0;
+}
+
+/**
+ * Checks whether the standby moved to a new block the primary has not announced yet.
+ *
+ * @param primaryPrevhash The prevhash of the last job received from the primary.
+ * @param lagMs How long the primary may lag behind before it is considered stale.
+ */
+bool standby_isAhead(const std::string &primaryPrevhash, uint32_t lagMs)
+{
+    if (!standby_isReady() || primaryPrevhash.empty())
+    {
+        return false;
+    }
+    // Only comparable if both pools were on the same tip before (same chain)
+    return standby.previousPrevhash == primaryPrevhash &&
+           standby.prevhash != primaryPrevhash &&
+           millis() - standby.prevhashAtMs > lagMs;
+}
+
+/**
+ * Hands the standby session over to the caller as the new primary: the socket,
+ * pending input, subscribe, difficulty and latest job. A job older than
+ * STANDBY_JOB_STALE_MS is dropped, mining then waits for the next notify rather than
+ * hash on a job the pool no longer accepts. The standby slot is then rebuilt against
+ * the next best pool.
+ *
+ * @param client The primary client, replaced by the standby socket.
+ * @param inputLine The primary partial line buffer, replaced by the standby one.
+ * @return false if the standby was not ready.
+ */
+bool standby_takeover(WiFiClient &client, String &inputLine)
+{
+    if (!standby_isReady())
+    {
+        return false;
+    }
+
+    client.stop();
+    client = standby.client;
+    standby.client = WiFiClient();
+    inputLine = standby.inputLine;
+
+    const bool stale = millis() - standby.notifiedAtMs > STANDBY_JOB_STALE_MS;
+    if (stale)
+    {
+        l_error(TAG_STANDBY, "Last standby job is %u ms old, waiting for a new one", millis() - standby.notifiedAtMs);
+        // Nothing of the previous pool's session can be mined on the new one either
+        current_resetSession();
+    }
+    if (standby.difficulty > 0)
+    {
+        current_setDifficulty(standby.difficulty);
+    }
+    current_setSubscribe(standby.subscribe);
+    standby.subscribe = nullptr;
+    if (!stale)
+    {
+        current_setJob(*standby.notification);
+    }
+
+    standby_clear();
+    standby.pool = -1;
+    standby.retryAtMs = millis();
+    return true;
+}
@@ -0,0 +1,18 @@
+#ifndef STANDBY_H
+#define STANDBY_H
+#include <string>
+#include <stdint.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif // ESP8266
+
+void standby_loop();
+void standby_reset();
+bool standby_isReady();
+int standby_getPool();
+uint32_t standby_getReadyMs();
+bool standby_isAhead(const std::string &primaryPrevhash, uint32_t lagMs);
+bool standby_takeover(WiFiClient &client, String &inputLine);
+#endif // STANDBY_H
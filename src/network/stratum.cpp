@@ -0,0 +1,177 @@
+#include <Arduino.h>
+#include "stratum.h"
+#include "utils/log.h"
+
+#define STRATUM_METHOD_SLOTS 8
+
+char TAG_STRATUM[] = "Stratum";
+
+struct StratumMethodEntry
+{
+    const char *name;
+    StratumMethod method;
+};
+
+/**
+ * Inbound methods laid out by stratum_methodSlot(), which is collision free for them.
+ * Any other name lands on an empty slot or fails the final strcmp.
+ */
+static const StratumMethodEntry methods[STRATUM_METHOD_SLOTS] = {
+    {nullptr, STRATUM_UNKNOWN},
+    {"mining.set_difficulty", STRATUM_SET_DIFFICULTY},
+    {"mining.set_extranonce", STRATUM_SET_EXTRANONCE},
+    {"mining.notify", STRATUM_NOTIFY},
+    {nullptr, STRATUM_UNKNOWN},
+    {nullptr, STRATUM_UNKNOWN},
+    {nullptr, STRATUM_UNKNOWN},
+    {nullptr, STRATUM_UNKNOWN},
+};
+
+// Indexed by id, direct mapped: ids are sequential so in-flight requests never collide
+static StratumRequest pending[STRATUM_PENDING_SIZE];
+
+static uint8_t stratum_methodSlot(const char *name, size_t length)
+{
+    return (length + (uint8_t)name[11]) & (STRATUM_METHOD_SLOTS - 1);
+}
+
+/**
+ * Maps an inbound method name to its handler with one hash and one string compare.
+ */
+StratumMethod stratum_method(const char *name)
+{
+    const size_t length = strlen(name);
+    if (length < 12)
+    {
+        return STRATUM_UNKNOWN;
+    }
+
+    const StratumMethodEntry &entry = methods[stratum_methodSlot(name, length)];
+    if (entry.name == nullptr || strcmp(entry.name, name) != 0)
+    {
+        return STRATUM_UNKNOWN;
+    }
+    return entry.method;
+}
+
+/**
+ * Maps an outbound method name back to the request kind, for the lines of a capture.
+ * A block submit reads as a plain submit, a probe as an authorize.
+ */
+StratumMethod stratum_requestMethod(const char *name)
+{
+    for (uint8_t method = STRATUM_SUBSCRIBE; method <= STRATUM_SUBMIT; method++)
+    {
+        if (strcmp(stratum_methodName((StratumMethod)method), name) == 0)
+        {
+            return (StratumMethod)method;
+        }
+    }
+    return STRATUM_UNKNOWN;
+}
+
+const char *stratum_methodName(StratumMethod method)
+{
+    switch (method)
+    {
+    case STRATUM_SUBSCRIBE:
+        return "mining.subscribe";
+    case STRATUM_AUTHORIZE:
+        return "mining.authorize";
+    case STRATUM_SUGGEST_DIFFICULTY:
+        return "mining.suggest_difficulty";
+    case STRATUM_EXTRANONCE_SUBSCRIBE:
+        return "mining.extranonce.subscribe";
+    case STRATUM_SUBMIT:
+    case STRATUM_SUBMIT_BLOCK:
+        return "mining.submit";
+    case STRATUM_PROBE:
+        return "probe";
+    case STRATUM_NOTIFY:
+        return "mining.notify";
+    case STRATUM_SET_DIFFICULTY:
+        return "mining.set_difficulty";
+    case STRATUM_SET_EXTRANONCE:
+        return "mining.set_extranonce";
+    case STRATUM_UNKNOWN:
+        break;
+    }
+    return "unknown";
+}
+
+/**
+ * Records an outbound request so that its response can be routed by id.
+ *
+ * @param id The JSON-RPC id of the request.
+ * @param method What was asked.
+ * @param context Method specific data handed back with the response.
+ * @param sent_ms When the request was built, for a share when it was found.
+ */
+void stratum_track(uint64_t id, StratumMethod method, uint32_t context, uint32_t sent_ms)
+{
+    StratumRequest &slot = pending[id & (STRATUM_PENDING_SIZE - 1)];
+    if (slot.method != STRATUM_UNKNOWN)
+    {
+        l_debug(TAG_STRATUM, "Request %llu (%s) never answered", slot.id, stratum_methodName(slot.method));
+    }
+    slot.id = id;
+    slot.method = method;
+    slot.sent_ms = sent_ms;
+    slot.written_ms = 0;
+    slot.context = context;
+}
+
+/**
+ * Records when a request was written to the socket.
+ */
+void stratum_written(uint64_t id, uint32_t now_ms)
+{
+    StratumRequest &slot = pending[id & (STRATUM_PENDING_SIZE - 1)];
+    if (slot.method != STRATUM_UNKNOWN && slot.id == id)
+    {
+        slot.written_ms = now_ms;
+    }
+}
+
+/**
+ * Takes out one request of a kind left unanswered for too long. One that never got
+ * written, e.g. stuck behind a dead socket, expires as long after it was built.
+ *
+ * @param method The kind of request.
+ * @param timeout_ms How long after its write, else after it was built, a request is given up.
+ * @param request Filled with the expired request.
+ * @return false once none is left.
+ */
+bool stratum_takeExpired(StratumMethod method, uint32_t timeout_ms, StratumRequest &request)
+{
+    const uint32_t now = millis();
+    for (StratumRequest &slot : pending)
+    {
+        if (slot.method == method && now - (slot.written_ms != 0 ? slot.written_ms : slot.sent_ms) > timeout_ms)
+        {
+            request = slot;
+            slot = StratumRequest();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Looks up and forgets the request answered by a response.
+ *
+ * @param id The JSON-RPC id of the response.
+ * @param request Filled with the matching request.
+ * @return false if no request with this id is waiting, e.g. a late or duplicate response.
+ */
+bool stratum_take(uint64_t id, StratumRequest &request)
+{
+    StratumRequest &slot = pending[id & (STRATUM_PENDING_SIZE - 1)];
+    if (slot.method == STRATUM_UNKNOWN || slot.id != id)
+    {
+        return false;
+    }
+    request = slot;
+    slot = StratumRequest();
+    return true;
+}
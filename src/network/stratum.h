@@ -0,0 +1,45 @@
+#ifndef STRATUM_H
+#define STRATUM_H
+
+#include <stdint.h>
+
+#define STRATUM_PENDING_SIZE 32 // power of 2, more than the requests ever in flight
+
+enum StratumMethod : uint8_t
+{
+    STRATUM_UNKNOWN,
+    // Requests sent by the client, answered by id
+    STRATUM_SUBSCRIBE,
+    STRATUM_AUTHORIZE,
+    STRATUM_SUGGEST_DIFFICULTY,
+    STRATUM_EXTRANONCE_SUBSCRIBE,
+    STRATUM_SUBMIT,
+    STRATUM_SUBMIT_BLOCK, // a share meeting the network target
+    STRATUM_PROBE,
+    // Notifications sent by the pool, dispatched by name
+    STRATUM_NOTIFY,
+    STRATUM_SET_DIFFICULTY,
+    STRATUM_SET_EXTRANONCE
+};
+
+/**
+ * An outbound request waiting for its response.
+ */
+struct StratumRequest
+{
+    uint64_t id = 0;
+    StratumMethod method = STRATUM_UNKNOWN;
+    uint32_t sent_ms = 0;    // when the request was built, for a share when it was found
+    uint32_t written_ms = 0; // when it left on the socket, 0 while queued
+    uint32_t context = 0;    // method specific, e.g. the job generation a share was found on
+};
+
+StratumMethod stratum_method(const char *name);
+StratumMethod stratum_requestMethod(const char *name);
+const char *stratum_methodName(StratumMethod method);
+void stratum_track(uint64_t id, StratumMethod method, uint32_t context, uint32_t sent_ms);
+bool stratum_take(uint64_t id, StratumRequest &request);
+void stratum_written(uint64_t id, uint32_t now_ms);
+bool stratum_takeExpired(StratumMethod method, uint32_t timeout_ms, StratumRequest &request);
+
+#endif // STRATUM_H
@@ -0,0 +1,644 @@
+#include <Arduino.h>
+#include "sv2.h"
+#include "current.h"
+#include "leafminer.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+#include "model/configuration.h"
+#include "network.h"
+#include "shares.h"
+
+#define SV2_JOBS 4
+#define SV2_SHARES 8 // submits waiting for a result
+#define SV2_OPEN_CHANNEL_REQUEST_ID 1
+
+extern Configuration configuration;
+char TAG_SV2[] = "SV2";
+
+/**
+ * Bounded little-endian writer for SV2 payloads. Any overflow latches `ok` to false.
+ */
+struct Sv2Writer
+{
+    uint8_t *out;
+    size_t size;
+    size_t len;
+    bool ok;
+
+    Sv2Writer(uint8_t *out, size_t size) : out(out), size(size), len(SV2_HEADER_SIZE), ok(size >= SV2_HEADER_SIZE) {}
+
+    void bytes(const void *data, size_t n)
+    {
+        if (!ok || len + n > size)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(out + len, data, n);
+        len += n;
+    }
+    void u8(uint8_t v) { bytes(&v, 1); }
+    void u16(uint16_t v)
+    {
+        uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+        bytes(b, 2);
+    }
+    void u32(uint32_t v)
+    {
+        uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+        bytes(b, 4);
+    }
+    void f32(float v)
+    {
+        uint32_t bits;
+        memcpy(&bits, &v, 4);
+        u32(bits);
+    }
+    void str0_255(const char *s)
+    {
+        size_t n = strlen(s);
+        if (n > 255)
+        {
+            n = 255;
+        }
+        u8((uint8_t)n);
+        bytes(s, n);
+    }
+
+    /**
+     * Writes the frame header in front of the payload.
+     * @return The total frame size, or 0 if the buffer was too small.
+     */
+    size_t finish(uint16_t extension_type, uint8_t msg_type)
+    {
+        if (!ok)
+        {
+            return 0;
+        }
+        const uint32_t length = len - SV2_HEADER_SIZE;
+        out[0] = (uint8_t)extension_type;
+        out[1] = (uint8_t)(extension_type >> 8);
+        out[2] = msg_type;
+        out[3] = (uint8_t)length;
+        out[4] = (uint8_t)(length >> 8);
+        out[5] = (uint8_t)(length >> 16);
+        return len;
+    }
+};
+
+/**
+ * Bounded little-endian reader over a frame payload. Any overrun latches `ok` to false.
+ */
+struct Sv2Reader
+{
+    const uint8_t *in;
+    size_t size;
+    size_t pos;
+    bool ok;
+
+    Sv2Reader(const Sv2Frame &frame) : in(frame.payload), size(frame.length), pos(0), ok(true) {}
+
+    void bytes(void *data, size_t n)
+    {
+        if (!ok || pos + n > size)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(data, in + pos, n);
+        pos += n;
+    }
+    uint8_t u8()
+    {
+        uint8_t v = 0;
+        bytes(&v, 1);
+        return v;
+    }
+    uint32_t u32()
+    {
+        uint8_t b[4] = {};
+        bytes(b, 4);
+        return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+    void skip(size_t n)
+    {
+        if (!ok || pos + n > size)
+        {
+            ok = false;
+            return;
+        }
+        pos += n;
+    }
+    std::string str0_255()
+    {
+        const uint8_t n = u8();
+        if (!ok || pos + n > size)
+        {
+            ok = false;
+            return "";
+        }
+        std::string s((const char *)in + pos, n);
+        pos += n;
+        return s;
+    }
+};
+
+bool Sv2Decoder::push(uint8_t byte)
+{
+    if (received < SV2_HEADER_SIZE)
+    {
+        header[received++] = byte;
+        if (received == SV2_HEADER_SIZE)
+        {
+            current.extension_type = header[0] | (header[1] << 8);
+            current.msg_type = header[2];
+            current.length = header[3] | (header[4] << 8) | ((uint32_t)header[5] << 16);
+            current.payload = payload;
+            if (current.length == 0)
+            {
+                received = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const size_t offset = received - SV2_HEADER_SIZE;
+    if (offset < SV2_MAX_PAYLOAD)
+    {
+        payload[offset] = byte;
+    }
+    received++;
+
+    if (received - SV2_HEADER_SIZE < current.length)
+    {
+        return false;
+    }
+
+    received = 0;
+    if (current.length > SV2_MAX_PAYLOAD)
+    {
+        l_error(TAG_SV2, "Frame 0x%02x too big (%u bytes), skipped", current.msg_type, current.length);
+        return false;
+    }
+    return true;
+}
+
+void Sv2Decoder::reset()
+{
+    received = 0;
+}
+
+size_t sv2_encodeSetupConnection(uint8_t *out, size_t size, const char *host, uint16_t port, const char *firmware)
+{
+    Sv2Writer w(out, size);
+    w.u8(SV2_PROTOCOL_MINING);
+    w.u16(SV2_VERSION); // min_version
+    w.u16(SV2_VERSION); // max_version
+    w.u32(SV2_FLAG_REQUIRES_STANDARD_JOBS);
+    w.str0_255(host);
+    w.u16(port);
+    w.str0_255("LeafMiner");
+#if defined(ESP8266)
+    w.str0_255("ESP8266");
+#else
+    w.str0_255("ESP32");
+#endif
+    w.str0_255(firmware);
+    w.str0_255(""); // device_id
+    return w.finish(0, SV2_SETUP_CONNECTION);
+}
+
+size_t sv2_encodeOpenStandardMiningChannel(uint8_t *out, size_t size, uint32_t request_id, const char *user, float hashrate)
+{
+    Sv2Writer w(out, size);
+    w.u32(request_id);
+    w.str0_255(user);
+    w.f32(hashrate);
+    uint8_t max_target[32];
+    memset(max_target, 0xff, sizeof(max_target));
+    w.bytes(max_target, sizeof(max_target));
+    return w.finish(0, SV2_OPEN_STANDARD_MINING_CHANNEL);
+}
+
+size_t sv2_encodeSubmitSharesStandard(uint8_t *out, size_t size, uint32_t channel_id, uint32_t sequence_number, uint32_t job_id, uint32_t nonce, uint32_t ntime, uint32_t version)
+{
+    Sv2Writer w(out, size);
+    w.u32(channel_id);
+    w.u32(sequence_number);
+    w.u32(job_id);
+    w.u32(nonce);
+    w.u32(ntime);
+    w.u32(version);
+    return w.finish(SV2_CHANNEL_BIT, SV2_SUBMIT_SHARES_STANDARD);
+}
+
+bool sv2_parseNewMiningJob(const Sv2Frame &frame, Sv2NewMiningJob &message)
+{
+    Sv2Reader r(frame);
+    message.channel_id = r.u32();
+    message.job_id = r.u32();
+    // OPTION[U32] is a 0/1 length prefixed sequence
+    message.has_min_ntime = r.u8() == 1;
+    message.min_ntime = message.has_min_ntime ? r.u32() : 0;
+    message.version = r.u32();
+    r.bytes(message.merkle_root, 32);
+    return r.ok;
+}
+
+bool sv2_parseSetNewPrevHash(const Sv2Frame &frame, Sv2SetNewPrevHash &message)
+{
+    Sv2Reader r(frame);
+    message.channel_id = r.u32();
+    message.job_id = r.u32();
+    r.bytes(message.prev_hash, 32);
+    message.min_ntime = r.u32();
+    message.nbits = r.u32();
+    return r.ok;
+}
+
+bool sv2_parseOpenChannelSuccess(const Sv2Frame &frame, Sv2OpenChannelSuccess &message)
+{
+    Sv2Reader r(frame);
+    message.request_id = r.u32();
+    message.channel_id = r.u32();
+    r.bytes(message.target, 32);
+    return r.ok;
+}
+
+bool sv2_parseSetTarget(const Sv2Frame &frame, uint32_t &channel_id, uint8_t *target)
+{
+    Sv2Reader r(frame);
+    channel_id = r.u32();
+    r.bytes(target, 32);
+    return r.ok;
+}
+
+bool sv2_parseSubmitResult(const Sv2Frame &frame, Sv2SubmitResult &message)
+{
+    Sv2Reader r(frame);
+    message.channel_id = r.u32();
+    message.sequence_number = r.u32();
+    message.accepted_count = 0;
+    if (frame.msg_type == SV2_SUBMIT_SHARES_SUCCESS)
+    {
+        message.accepted_count = r.u32();
+        r.skip(8); // new_shares_sum
+    }
+    else
+    {
+        message.error_code = r.str0_255();
+    }
+    return r.ok;
+}
+
+/**
+ * A submit waiting for its result, SubmitShares.Success/Error refer to it by sequence number.
+ */
+struct Sv2Share
+{
+    uint32_t sequence;
+    uint32_t generation; // job generation the share was found on
+    uint32_t found_ms;
+    uint32_t written_ms;
+};
+
+// Client session state
+static Sv2Decoder decoder;
+static Sv2Loopback loopback = nullptr;
+static bool setupDone = false;
+static bool refused = false;
+static bool channelOpen = false;
+static uint32_t channelId = 0;
+static uint32_t sequenceNumber = 0;
+static Sv2NewMiningJob jobs[SV2_JOBS];
+static size_t jobsCount = 0;
+static Sv2SetNewPrevHash prevHash;
+static bool hasPrevHash = false;
+static Sv2Share shares[SV2_SHARES];
+static size_t sharesCount = 0;
+
+static void sv2_write(WiFiClient &client, const uint8_t *frame, size_t len)
+{
+    if (len == 0)
+    {
+        l_error(TAG_SV2, "Frame encoding failed");
+        return;
+    }
+    if (loopback != nullptr)
+    {
+        loopback(frame, len);
+        return;
+    }
+    client.write(frame, len);
+}
+
+/**
+ * Remembers a submit until its result, the oldest one is given up when full.
+ */
+static void sv2_trackShare(const Sv2Share &share)
+{
+    if (sharesCount == SV2_SHARES)
+    {
+        shares_record(SHARE_TIMED_OUT, shares[0].found_ms, shares[0].written_ms, 0);
+        memmove(&shares[0], &shares[1], sizeof(Sv2Share) * (SV2_SHARES - 1));
+        sharesCount--;
+    }
+    shares[sharesCount++] = share;
+}
+
+/**
+ * Takes out a submit the pool answered.
+ *
+ * @param sequence The sequence number of the result.
+ * @param exact false to take the oldest submit up to it, a success covers them all.
+ * @return false once there is none.
+ */
+static bool sv2_takeShare(uint32_t sequence, bool exact, Sv2Share &share)
+{
+    for (size_t i = 0; i < sharesCount; ++i)
+    {
+        if (exact ? shares[i].sequence == sequence : (int32_t)(shares[i].sequence - sequence) <= 0)
+        {
+            share = shares[i];
+            memmove(&shares[i], &shares[i + 1], sizeof(Sv2Share) * (sharesCount - i - 1));
+            sharesCount--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Converts a U256 share target into the difficulty used by the miner loop.
+ */
+static void sv2_applyTarget(const uint8_t *target)
+{
+    const double value = littleEndian256ToDouble(target);
+    if (value > 0)
+    {
+        current_setDifficulty(TRUEDIFFONE / value);
+    }
+}
+
+static const Sv2NewMiningJob *sv2_findJob(uint32_t job_id)
+{
+    for (size_t i = 0; i < jobsCount; ++i)
+    {
+        if (jobs[i].job_id == job_id)
+        {
+            return &jobs[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Turns a job into a mineable header. The pool computed the merkle root already,
+ * so there is no coinbase assembly and no merkle loop here.
+ */
+static void sv2_activate(const Sv2NewMiningJob &job, bool clean_jobs)
+{
+    if (!hasPrevHash)
+    {
+        return;
+    }
+
+    Block header;
+    header.version = job.version;
+    memcpy(header.previous_block, prevHash.prev_hash, 32);
+    memcpy(header.merkle_root, job.merkle_root, 32);
+    header.ntime = (job.has_min_ntime && job.min_ntime > prevHash.min_ntime) ? job.min_ntime : prevHash.min_ntime;
+    header.nbits = prevHash.nbits;
+    header.nonce = 0;
+
+    network_bumpJobGeneration();
+    current_setJob(new Job(std::to_string(job.job_id), header, current_getDifficulty()), clean_jobs);
+}
+
+static void sv2_storeJob(const Sv2NewMiningJob &job)
+{
+    if (jobsCount == SV2_JOBS)
+    {
+        memmove(&jobs[0], &jobs[1], sizeof(Sv2NewMiningJob) * (SV2_JOBS - 1));
+        jobsCount--;
+    }
+    jobs[jobsCount++] = job;
+}
+
+static void sv2_handle(WiFiClient &client, const Sv2Frame &frame)
+{
+    switch (frame.msg_type)
+    {
+    case SV2_SETUP_CONNECTION_SUCCESS:
+    {
+        l_info(TAG_SV2, "Connection set up, opening standard channel");
+        setupDone = true;
+        uint8_t out[128];
+        const float hashrate = current_get_hashrate() > 0 ? current_get_hashrate() * 1000.0 : 1000.0;
+        sv2_write(client, out, sv2_encodeOpenStandardMiningChannel(out, sizeof(out), SV2_OPEN_CHANNEL_REQUEST_ID, configuration.wallet_address.c_str(), hashrate));
+        return;
+    }
+    case SV2_SETUP_CONNECTION_ERROR:
+    case SV2_OPEN_MINING_CHANNEL_ERROR:
+        // The state machine drops the connection on its next step
+        l_error(TAG_SV2, "Handshake refused (0x%02x)", frame.msg_type);
+        refused = true;
+        return;
+    case SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS:
+    {
+        Sv2OpenChannelSuccess message;
+        if (!sv2_parseOpenChannelSuccess(frame, message))
+        {
+            break;
+        }
+        channelId = message.channel_id;
+        channelOpen = true;
+        sv2_applyTarget(message.target);
+        l_info(TAG_SV2, "Channel %u open", channelId);
+        return;
+    }
+    case SV2_NEW_MINING_JOB:
+    {
+        Sv2NewMiningJob message;
+        if (!sv2_parseNewMiningJob(frame, message) || message.channel_id != channelId)
+        {
+            break;
+        }
+        sv2_storeJob(message);
+        // A job with min_ntime can be mined right away on the current prev hash
+        if (message.has_min_ntime)
+        {
+            sv2_activate(message, false);
+        }
+        return;
+    }
+    case SV2_SET_NEW_PREV_HASH:
+    {
+        if (!sv2_parseSetNewPrevHash(frame, prevHash) || prevHash.channel_id != channelId)
+        {
+            break;
+        }
+        hasPrevHash = true;
+        const Sv2NewMiningJob *job = sv2_findJob(prevHash.job_id);
+        if (job != nullptr)
+        {
+            sv2_activate(*job, true);
+        }
+        return;
+    }
+    case SV2_SET_TARGET:
+    {
+        uint32_t channel;
+        uint8_t target[32];
+        if (!sv2_parseSetTarget(frame, channel, target) || channel != channelId)
+        {
+            break;
+        }
+        sv2_applyTarget(target);
+        return;
+    }
+    case SV2_SUBMIT_SHARES_SUCCESS:
+    case SV2_SUBMIT_SHARES_ERROR:
+    {
+        Sv2SubmitResult message;
+        if (!sv2_parseSubmitResult(frame, message))
+        {
+            break;
+        }
+        const uint32_t now = millis();
+        Sv2Share share;
+        if (frame.msg_type == SV2_SUBMIT_SHARES_SUCCESS)
+        {
+            // Accepts every share up to the sequence number
+            while (sv2_takeShare(message.sequence_number, false, share))
+            {
+                shares_record(SHARE_ACCEPTED, share.found_ms, share.written_ms, now);
+            }
+            for (uint32_t i = 0; i < message.accepted_count; ++i)
+            {
+                current_increment_hash_accepted();
+            }
+            return;
+        }
+
+        l_error(TAG_SV2, "Share %u rejected: %s", message.sequence_number, message.error_code.c_str());
+        if (!sv2_takeShare(message.sequence_number, true, share))
+        {
+            share = {message.sequence_number, network_getJobGeneration(), now, now};
+        }
+        // A share found on a previous job only says that job is gone
+        if (share.generation != network_getJobGeneration() || message.error_code == "stale-share")
+        {
+            shares_record(SHARE_STALE, share.found_ms, share.written_ms, now);
+            current_increment_hash_stale();
+        }
+        else
+        {
+            shares_record(message.error_code == "difficulty-too-low" ? SHARE_LOW_DIFFICULTY : SHARE_REJECTED, share.found_ms, share.written_ms, now);
+            current_increment_hash_rejected();
+        }
+        return;
+    }
+    default:
+        l_debug(TAG_SV2, "Ignored message 0x%02x", frame.msg_type);
+        return;
+    }
+
+    l_error(TAG_SV2, "Malformed message 0x%02x", frame.msg_type);
+}
+
+/**
+ * Starts the SV2 session on a freshly connected socket (plain, unencrypted transport).
+ */
+void sv2_handshake(WiFiClient &client, const char *host, uint16_t port)
+{
+    decoder.reset();
+    setupDone = false;
+    refused = false;
+    channelOpen = false;
+    hasPrevHash = false;
+    jobsCount = 0;
+    sequenceNumber = 0;
+    sharesCount = 0;
+
+    uint8_t out[256];
+    sv2_write(client, out, sv2_encodeSetupConnection(out, sizeof(out), host, port, _VERSION));
+}
+
+/**
+ * Drains the socket and handles every complete frame.
+ *
+ * @return true if any byte was received.
+ */
+bool sv2_listen(WiFiClient &client)
+{
+    bool gotData = false;
+    while (client.available())
+    {
+        gotData = true;
+        if (decoder.push((uint8_t)client.read()))
+        {
+            sv2_handle(client, decoder.frame());
+        }
+    }
+    return gotData;
+}
+
+/**
+ * Handles bytes as if they were read from the socket, for an in-process pool.
+ */
+void sv2_receive(WiFiClient &client, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (decoder.push(data[i]))
+        {
+            sv2_handle(client, decoder.frame());
+        }
+    }
+}
+
+/**
+ * Replaces the socket with an in-process pool, which gets every frame sent.
+ * Passing nullptr restores the socket.
+ */
+void sv2_setLoopback(Sv2Loopback frameLoopback)
+{
+    loopback = frameLoopback;
+}
+
+bool sv2_isReady()
+{
+    return setupDone && channelOpen;
+}
+
+/**
+ * @return true once the pool refused the connection or the channel.
+ */
+bool sv2_isRefused()
+{
+    return refused;
+}
+
+/**
+ * Submits a share on the standard channel.
+ *
+ * @param generation The job generation the share was found on.
+ * @param found_ms When the share was found.
+ */
+void sv2_send(WiFiClient &client, const std::string &job_id, const std::string &ntime, const uint32_t &nonce, uint32_t generation, uint32_t found_ms)
+{
+    const uint32_t id = strtoul(job_id.c_str(), nullptr, 10);
+    const Sv2NewMiningJob *job = sv2_findJob(id);
+    if (job == nullptr)
+    {
+        l_error(TAG_SV2, "Job %s unknown, share dropped", job_id.c_str());
+        return;
+    }
+
+    uint8_t out[64];
+    sv2_write(client, out, sv2_encodeSubmitSharesStandard(out, sizeof(out), channelId, ++sequenceNumber, id, nonce, strtoul(ntime.c_str(), nullptr, 16), job->version));
+    sv2_trackShare({sequenceNumber, generation, found_ms, millis()});
+    l_info(TAG_SV2, ">>> submit seq=%u job=%u nonce=0x%08x", sequenceNumber, id, nonce);
+}
@@ -0,0 +1,120 @@
+#ifndef SV2_H
+#define SV2_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif // ESP8266
+
+// Frame header: extension_type (U16) + msg_type (U8) + msg_length (U24)
+#define SV2_HEADER_SIZE 6
+#define SV2_MAX_PAYLOAD 512
+#define SV2_CHANNEL_BIT 0x8000
+
+// Common / mining protocol message types
+#define SV2_SETUP_CONNECTION 0x00
+#define SV2_SETUP_CONNECTION_SUCCESS 0x01
+#define SV2_SETUP_CONNECTION_ERROR 0x02
+#define SV2_OPEN_STANDARD_MINING_CHANNEL 0x10
+#define SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS 0x11
+#define SV2_OPEN_MINING_CHANNEL_ERROR 0x12
+#define SV2_NEW_MINING_JOB 0x15
+#define SV2_SUBMIT_SHARES_STANDARD 0x1a
+#define SV2_SUBMIT_SHARES_SUCCESS 0x1c
+#define SV2_SUBMIT_SHARES_ERROR 0x1d
+#define SV2_SET_NEW_PREV_HASH 0x20
+#define SV2_SET_TARGET 0x21
+
+#define SV2_PROTOCOL_MINING 0
+#define SV2_VERSION 2
+#define SV2_FLAG_REQUIRES_STANDARD_JOBS 0x01
+
+struct Sv2Frame
+{
+    uint16_t extension_type;
+    uint8_t msg_type;
+    uint32_t length;
+    const uint8_t *payload;
+};
+
+struct Sv2NewMiningJob
+{
+    uint32_t channel_id;
+    uint32_t job_id;
+    bool has_min_ntime; // false means future job, activated by SetNewPrevHash
+    uint32_t min_ntime;
+    uint32_t version;
+    uint8_t merkle_root[32];
+};
+
+struct Sv2SetNewPrevHash
+{
+    uint32_t channel_id;
+    uint32_t job_id;
+    uint8_t prev_hash[32];
+    uint32_t min_ntime;
+    uint32_t nbits;
+};
+
+struct Sv2OpenChannelSuccess
+{
+    uint32_t request_id;
+    uint32_t channel_id;
+    uint8_t target[32];
+};
+
+struct Sv2SubmitResult
+{
+    uint32_t channel_id;
+    uint32_t sequence_number;
+    uint32_t accepted_count; // SubmitShares.Success only
+    std::string error_code;  // SubmitShares.Error only
+};
+
+/**
+ * Incremental frame decoder: bytes are pushed one at a time from the socket
+ * and a complete frame becomes available without any allocation.
+ * Frames bigger than SV2_MAX_PAYLOAD are skipped.
+ */
+class Sv2Decoder
+{
+public:
+    bool push(uint8_t byte);
+    const Sv2Frame &frame() const { return current; }
+    void reset();
+
+private:
+    uint8_t header[SV2_HEADER_SIZE];
+    uint8_t payload[SV2_MAX_PAYLOAD];
+    size_t received = 0;
+    Sv2Frame current = {};
+};
+
+size_t sv2_encodeSetupConnection(uint8_t *out, size_t size, const char *host, uint16_t port, const char *firmware);
+size_t sv2_encodeOpenStandardMiningChannel(uint8_t *out, size_t size, uint32_t request_id, const char *user, float hashrate);
+size_t sv2_encodeSubmitSharesStandard(uint8_t *out, size_t size, uint32_t channel_id, uint32_t sequence_number, uint32_t job_id, uint32_t nonce, uint32_t ntime, uint32_t version);
+
+bool sv2_parseNewMiningJob(const Sv2Frame &frame, Sv2NewMiningJob &message);
+bool sv2_parseSetNewPrevHash(const Sv2Frame &frame, Sv2SetNewPrevHash &message);
+bool sv2_parseOpenChannelSuccess(const Sv2Frame &frame, Sv2OpenChannelSuccess &message);
+bool sv2_parseSetTarget(const Sv2Frame &frame, uint32_t &channel_id, uint8_t *target);
+bool sv2_parseSubmitResult(const Sv2Frame &frame, Sv2SubmitResult &message);
+
+/**
+ * Receives every frame the client sends when the socket is replaced, see sv2_setLoopback().
+ */
+typedef void (*Sv2Loopback)(const uint8_t *frame, size_t length);
+
+void sv2_handshake(WiFiClient &client, const char *host, uint16_t port);
+bool sv2_listen(WiFiClient &client);
+void sv2_receive(WiFiClient &client, const uint8_t *data, size_t length);
+void sv2_setLoopback(Sv2Loopback frameLoopback);
+bool sv2_isReady();
+bool sv2_isRefused();
+void sv2_send(WiFiClient &client, const std::string &job_id, const std::string &ntime, const uint32_t &nonce, uint32_t generation, uint32_t found_ms);
+
+#endif // SV2_H
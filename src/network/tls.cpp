@@ -0,0 +1,60 @@
+#include <Arduino.h>
+#include "tls.h"
+#include "resolver.h"
+#include "utils/log.h"
+
+char TAG_TLS[] = "TLS";
+
+#if defined(ESP8266)
+static BearSSL::Session session; // kept across reconnects for session resumption
+#endif
+
+/**
+ * Opens a TLS connection. The certificate is not verified: pools mostly use self-signed
+ * ones, TLS is there to keep the stratum traffic private.
+ *
+ * The addresses are tried in turn, the timeout split between them. On ESP8266 the BearSSL
+ * session is kept across connects, so a reconnect resumes it and skips the key exchange
+ * when the server allows it. BearSSL only sends SNI when it resolves the host itself,
+ * which would bypass the resolver cache and block for a whole DNS query, so no SNI is
+ * sent there.
+ *
+ * On ESP32 the host name goes out for SNI. Every connect is a full handshake: esp-tls can
+ * resume from a session ticket, but WiFiClientSecure sets up and runs the handshake in
+ * one call and does not expose that option.
+ *
+ * @param client The client to connect.
+ * @param host The host name, sent for SNI on ESP32.
+ * @param addresses The addresses from resolver_resolve(), best first.
+ * @param count The number of addresses.
+ * @param port The port to connect to.
+ * @param address Set to the address connected to, left unset if it is not known.
+ * @return true once the handshake is done.
+ */
+bool tls_connect(TlsClient &client, const char *host, const IPAddress *addresses, uint8_t count, uint16_t port, IPAddress &address)
+{
+    address = IPAddress();
+    client.setInsecure();
+#if defined(ESP8266)
+    client.setSession(&session);
+    client.setTimeout(TLS_TIMEOUT_MS / (count > 0 ? count : 1));
+#else
+    client.setHandshakeTimeout(TLS_TIMEOUT_MS / 1000 / (count > 0 ? count : 1));
+#endif // ESP8266
+    for (uint8_t i = 0; i < count; i++)
+    {
+#if defined(ESP8266)
+        if (client.connect(addresses[i], port) && client.connected())
+#else
+        if (client.connect(addresses[i], port, host, nullptr, nullptr, nullptr) && client.connected())
+#endif // ESP8266
+        {
+            address = addresses[i];
+            return true;
+        }
+        l_debug(TAG_TLS, "%s: no handshake with %s", host, addresses[i].toString().c_str());
+    }
+    // The host may have moved, query DNS again next time
+    resolver_forget(host);
+    return false;
+}
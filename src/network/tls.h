@@ -0,0 +1,26 @@
+#ifndef TLS_H
+#define TLS_H
+#include <stdint.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecureBearSSL.h>
+typedef BearSSL::WiFiClientSecure TlsClient;
+#else
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+typedef WiFiClientSecure TlsClient;
+#endif // ESP8266
+
+/**
+ * Bound on a whole TLS connect. Arduino cores only handshake synchronously: on ESP8266
+ * this runs on the loop task and stalls hashing for as long, so it is kept shorter there.
+ * On ESP32 it only holds up the network task.
+ */
+#if defined(ESP8266)
+#define TLS_TIMEOUT_MS 5000
+#else
+#define TLS_TIMEOUT_MS 10000
+#endif // ESP8266
+
+bool tls_connect(TlsClient &client, const char *host, const IPAddress *addresses, uint8_t count, uint16_t port, IPAddress &address);
+#endif // TLS_H
@@ -4,6 +4,7 @@
 #include "model/configuration.h"
 #include "current.h"
 #include "leafminer.h"
+#include "utils/probe.h"
 #include "lilygo-t-s3-include.h"
 #include "geekmagicclock-smalltv-include.h"
 
@@ -50,6 +51,7 @@ void screen_setup()
 
 void screen_loop()
 {
+  PROBE_SCOPE(PROBE_SCREEN);
   if (!screen_enabled)
   {
     return;
@@ -0,0 +1,321 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <string>
+#include "lifetime.h"
+#include "current.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+#define LIFETIME_MAGIC "LMLT"
+#define LIFETIME_RECORD_MAX (1 + 5 * 10 + 8 + 1)
+
+char TAG_LIFETIME[] = "Lifetime";
+static std::string lifetimePath = "";
+static LifetimeStats stored;   // totals in the log
+static LifetimeStats logged;   // counters of this boot at the last append
+static uint32_t loggedMs = 0;
+static size_t deltas = 0;
+static bool torn = false; // the log ends with a damaged record, appends would follow it
+
+static bool lifetime_mount()
+{
+#if defined(ESP8266)
+    return LittleFS.begin();
+#else
+    return LittleFS.begin(true); // format on first use
+#endif
+}
+
+static size_t lifetime_varint(uint8_t *out, uint64_t value)
+{
+    size_t length = 0;
+    do
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    return length;
+}
+
+static bool lifetime_readVarint(File &file, uint8_t *record, size_t &length, uint64_t &value)
+{
+    value = 0;
+    for (uint8_t shift = 0; shift < 64; shift += 7)
+    {
+        const int byte = file.read();
+        if (byte < 0)
+        {
+            return false;
+        }
+        record[length++] = byte;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return The counters of this boot, the figures the deltas are taken from.
+ */
+static LifetimeStats lifetime_counters()
+{
+    LifetimeStats counters;
+    counters.hashes = current_get_hashes_total();
+    counters.accepted = current_get_hash_accepted();
+    counters.rejected = current_get_hash_rejected();
+    counters.blocks = current_get_block_found();
+    counters.uptime_s = millis() / 1000;
+    counters.best_difficulty = current_getHighestDifficulty();
+    return counters;
+}
+
+static bool lifetime_writeBase(const char *path, const LifetimeStats &stats)
+{
+    uint8_t base[8 + sizeof(LifetimeStats) + 4] = {LIFETIME_MAGIC[0], LIFETIME_MAGIC[1], LIFETIME_MAGIC[2], LIFETIME_MAGIC[3], LIFETIME_VERSION};
+    memcpy(base + 8, &stats, sizeof(stats));
+    const uint32_t checksum = fnv1a(base, sizeof(base) - 4);
+    memcpy(base + sizeof(base) - 4, &checksum, 4);
+
+    File file = LittleFS.open(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+    const bool written = file.write(base, sizeof(base)) == sizeof(base);
+    file.close();
+    return written;
+}
+
+static bool lifetime_read(const char *path)
+{
+    File file = LittleFS.open(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    uint8_t base[8 + sizeof(LifetimeStats) + 4];
+    uint32_t checksum;
+    if (file.read(base, sizeof(base)) != sizeof(base) || memcmp(base, LIFETIME_MAGIC, 4) != 0 || base[4] != LIFETIME_VERSION ||
+        (memcpy(&checksum, base + sizeof(base) - 4, 4), checksum != fnv1a(base, sizeof(base) - 4)))
+    {
+        l_error(TAG_LIFETIME, "%s is not a lifetime log", path);
+        file.close();
+        return false;
+    }
+    memcpy(&stored, base + 8, sizeof(stored));
+
+    // Apply the deltas up to the first one that does not check out
+    deltas = 0;
+    torn = false;
+    uint8_t record[LIFETIME_RECORD_MAX];
+    int marker;
+    while ((marker = file.read()) >= 0)
+    {
+        size_t length = 0;
+        record[length++] = marker;
+        uint64_t values[5];
+        bool valid = marker == LIFETIME_DELTA || marker == LIFETIME_DELTA_BEST;
+        for (uint64_t &value : values)
+        {
+            valid = valid && lifetime_readVarint(file, record, length, value);
+        }
+        double best = stored.best_difficulty;
+        if (valid && marker == LIFETIME_DELTA_BEST)
+        {
+            valid = file.read(record + length, sizeof(best)) == sizeof(best);
+            memcpy(&best, record + length, sizeof(best));
+            length += sizeof(best);
+        }
+        if (!valid || file.read() != (int)(fnv1a(record, length) & 0xff))
+        {
+            l_error(TAG_LIFETIME, "Torn record after %u deltas, ignored", deltas);
+            torn = true;
+            break;
+        }
+
+        stored.hashes += values[0];
+        stored.accepted += values[1];
+        stored.rejected += values[2];
+        stored.blocks += values[3];
+        stored.uptime_s += values[4];
+        stored.best_difficulty = best;
+        deltas++;
+    }
+    file.close();
+    return true;
+}
+
+/**
+ * Rewrites the log as a single base record. The new log is written aside first and renamed
+ * over the old one, so that a reset in between loses nothing.
+ */
+static void lifetime_compact()
+{
+    const std::string temporary = lifetimePath + ".tmp";
+    if (!lifetime_writeBase(temporary.c_str(), stored) || !LittleFS.rename(temporary.c_str(), lifetimePath.c_str()))
+    {
+        l_error(TAG_LIFETIME, "Compaction failed");
+        return;
+    }
+    deltas = 0;
+    l_debug(TAG_LIFETIME, "Log compacted");
+}
+
+/**
+ * Loads the lifetime totals, counting the ones of this boot from the current counters on.
+ *
+ * @param path The log file, created if missing.
+ * @return false if the filesystem could not be mounted or the log created.
+ */
+bool lifetime_setup(const char *path)
+{
+    lifetimePath = "";
+    stored = LifetimeStats();
+    deltas = 0;
+    logged = lifetime_counters();
+    loggedMs = millis();
+    if (!lifetime_mount())
+    {
+        l_error(TAG_LIFETIME, "Unable to mount the filesystem");
+        return false;
+    }
+
+    lifetimePath = path;
+    const std::string temporary = lifetimePath + ".tmp";
+    if (lifetime_read(path))
+    {
+        if (torn || deltas >= LIFETIME_MAX_DELTAS)
+        {
+            lifetime_compact();
+        }
+    }
+    else if (lifetime_read(temporary.c_str()))
+    {
+        // A compaction cut short before its rename, finish it
+        lifetime_compact();
+    }
+    else
+    {
+        stored = LifetimeStats();
+        if (!lifetime_writeBase(path, stored))
+        {
+            l_error(TAG_LIFETIME, "Unable to create %s", path);
+            lifetimePath = "";
+            return false;
+        }
+    }
+    l_info(TAG_LIFETIME, "%llu hashes, %u accepted, %u rejected, %u blocks in %u s", stored.hashes, stored.accepted,
+           stored.rejected, stored.blocks, stored.uptime_s);
+    return true;
+}
+
+/**
+ * Appends a delta every LIFETIME_INTERVAL_MS. Called from network_listen(), the only
+ * writer of the log.
+ */
+void lifetime_loop()
+{
+    if (millis() - loggedMs < LIFETIME_INTERVAL_MS)
+    {
+        return;
+    }
+    lifetime_save();
+}
+
+/**
+ * Appends what was counted since the last record, if anything.
+ */
+void lifetime_save()
+{
+    if (lifetimePath.empty())
+    {
+        return;
+    }
+    loggedMs = millis();
+    const LifetimeStats now = lifetime_counters();
+    const bool best = now.best_difficulty > stored.best_difficulty;
+    if (now.hashes == logged.hashes && now.accepted == logged.accepted && now.rejected == logged.rejected &&
+        now.blocks == logged.blocks && !best)
+    {
+        return;
+    }
+
+    uint8_t record[LIFETIME_RECORD_MAX];
+    size_t length = 0;
+    record[length++] = best ? LIFETIME_DELTA_BEST : LIFETIME_DELTA;
+    length += lifetime_varint(record + length, now.hashes - logged.hashes);
+    length += lifetime_varint(record + length, now.accepted - logged.accepted);
+    length += lifetime_varint(record + length, now.rejected - logged.rejected);
+    length += lifetime_varint(record + length, now.blocks - logged.blocks);
+    length += lifetime_varint(record + length, now.uptime_s - logged.uptime_s);
+    if (best)
+    {
+        memcpy(record + length, &now.best_difficulty, sizeof(now.best_difficulty));
+        length += sizeof(now.best_difficulty);
+    }
+    record[length] = fnv1a(record, length) & 0xff;
+    length++;
+
+    File file = LittleFS.open(lifetimePath.c_str(), "a");
+    if (!file)
+    {
+        l_error(TAG_LIFETIME, "Unable to open %s", lifetimePath.c_str());
+        return;
+    }
+    const bool written = file.write(record, length) == length;
+    file.close();
+    if (!written)
+    {
+        l_error(TAG_LIFETIME, "Unable to append to %s", lifetimePath.c_str());
+        return;
+    }
+
+    stored.hashes += now.hashes - logged.hashes;
+    stored.accepted += now.accepted - logged.accepted;
+    stored.rejected += now.rejected - logged.rejected;
+    stored.blocks += now.blocks - logged.blocks;
+    stored.uptime_s += now.uptime_s - logged.uptime_s;
+    if (best)
+    {
+        stored.best_difficulty = now.best_difficulty;
+    }
+    logged = now;
+    deltas++;
+
+    if (deltas >= LIFETIME_MAX_DELTAS)
+    {
+        lifetime_compact();
+    }
+}
+
+/**
+ * @return The stored totals plus what this boot counted since the last record.
+ */
+LifetimeStats lifetime_get()
+{
+    const LifetimeStats now = lifetime_counters();
+    LifetimeStats total = stored;
+    total.hashes += now.hashes - logged.hashes;
+    total.accepted += now.accepted - logged.accepted;
+    total.rejected += now.rejected - logged.rejected;
+    total.blocks += now.blocks - logged.blocks;
+    total.uptime_s += now.uptime_s - logged.uptime_s;
+    if (now.best_difficulty > total.best_difficulty)
+    {
+        total.best_difficulty = now.best_difficulty;
+    }
+    return total;
+}
+
+/**
+ * @return The delta records in the log since its last compaction.
+ */
+size_t lifetime_deltas()
+{
+    return lifetimePath.empty() ? 0 : deltas;
+}
@@ -0,0 +1,47 @@
+#ifndef LIFETIME_H
+#define LIFETIME_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Lifetime statistics of the device, kept across restarts in an append-only log on the
+ * flash filesystem.
+ *
+ * File layout: a base record with the totals at the last compaction
+ *   "LMLT" magic, U8 version, 3 reserved bytes, then the LifetimeStats fields, U32 FNV-1a
+ * followed by at most LIFETIME_MAX_DELTAS delta records
+ *   U8      LIFETIME_DELTA, or LIFETIME_DELTA_BEST when a best difficulty follows
+ *   varint  hashes, accepted, rejected, blocks, uptime seconds since the previous record
+ *   F64     new best difficulty, only for LIFETIME_DELTA_BEST
+ *   U8      low byte of the FNV-1a of the record
+ * A record torn by a reset fails its check and ends the log. Once the log holds
+ * LIFETIME_MAX_DELTAS deltas it is rewritten as a single base record, so that a load
+ * reads a bounded amount and the filesystem spreads the small appends over its blocks.
+ */
+#define LIFETIME_PATH "/lifetime.log"
+#define LIFETIME_VERSION 1
+#define LIFETIME_MAX_DELTAS 64
+#define LIFETIME_DELTA 0xa0
+#define LIFETIME_DELTA_BEST 0xa1
+
+#ifndef LIFETIME_INTERVAL_MS
+#define LIFETIME_INTERVAL_MS (15 * 60000)
+#endif // LIFETIME_INTERVAL_MS
+
+// Laid out without padding: the base record is written and checksummed as is
+struct LifetimeStats
+{
+    uint32_t accepted = 0;
+    uint32_t rejected = 0;
+    uint32_t blocks = 0;
+    uint32_t uptime_s = 0;
+    uint64_t hashes = 0;
+    double best_difficulty = 0;
+};
+
+bool lifetime_setup(const char *path);
+void lifetime_loop();
+void lifetime_save();
+LifetimeStats lifetime_get();
+size_t lifetime_deltas();
+#endif // LIFETIME_H
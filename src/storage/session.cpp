@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stddef.h>
+#include <string.h>
+#include "session.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+#define SESSION_NAMESPACE "session"
+#define SESSION_KEY "snapshot"
+
+char TAG_SESSION[] = "Session";
+static Preferences sessionPreferences;
+static SessionSnapshot latest;
+static SessionSnapshot saved;
+static bool sessionDirty = false; // latest differs from saved in its session part
+static bool statsDirty = false;
+static uint32_t savedMs = 0;
+
+// Everything up to the stats checkpoint
+#define SESSION_PART_SIZE offsetof(SessionSnapshot, best_difficulty)
+
+static uint32_t session_checksum(const SessionSnapshot &snapshot)
+{
+    // Everything but the checksum itself
+    return fnv1a(reinterpret_cast<const uint8_t *>(&snapshot), offsetof(SessionSnapshot, checksum));
+}
+
+/**
+ * Reads the snapshot written before the last restart.
+ *
+ * @param snapshot Filled with the snapshot.
+ * @return false if there is none, or if it is corrupt or from another format version.
+ */
+bool session_load(SessionSnapshot &snapshot)
+{
+    if (!sessionPreferences.begin(SESSION_NAMESPACE, true))
+    {
+        return false;
+    }
+    const size_t length = sessionPreferences.getBytes(SESSION_KEY, &snapshot, sizeof(snapshot));
+    sessionPreferences.end();
+
+    if (length != sizeof(snapshot) || snapshot.version != SESSION_VERSION || snapshot.checksum != session_checksum(snapshot))
+    {
+        l_info(TAG_SESSION, "No usable snapshot");
+        snapshot = SessionSnapshot();
+        return false;
+    }
+    // Strings were written terminated, make sure they still are
+    snapshot.host[sizeof(snapshot.host) - 1] = '\0';
+    snapshot.session_id[sizeof(snapshot.session_id) - 1] = '\0';
+    snapshot.extranonce1[sizeof(snapshot.extranonce1) - 1] = '\0';
+
+    saved = snapshot;
+    latest = snapshot;
+    return true;
+}
+
+/**
+ * Hands over the current state, written by session_loop() when its turn comes.
+ */
+void session_update(const SessionSnapshot &snapshot)
+{
+    latest = snapshot;
+    latest.version = SESSION_VERSION;
+    sessionDirty = memcmp(&latest, &saved, SESSION_PART_SIZE) != 0;
+    statsDirty = latest.accepted != saved.accepted || latest.rejected != saved.rejected ||
+                 latest.best_difficulty != saved.best_difficulty;
+}
+
+void session_loop()
+{
+    const uint32_t elapsed = millis() - savedMs;
+    if ((sessionDirty && elapsed >= SESSION_SAVE_INTERVAL_MS) || (statsDirty && elapsed >= SESSION_CHECKPOINT_INTERVAL_MS))
+    {
+        session_save();
+    }
+}
+
+/**
+ * Writes the latest state now if it changed.
+ */
+void session_save()
+{
+    if (!sessionDirty && !statsDirty)
+    {
+        return;
+    }
+    latest.checksum = session_checksum(latest);
+    if (!sessionPreferences.begin(SESSION_NAMESPACE, false))
+    {
+        l_error(TAG_SESSION, "Unable to open the snapshot storage");
+        return;
+    }
+    const size_t length = sessionPreferences.putBytes(SESSION_KEY, &latest, sizeof(latest));
+    sessionPreferences.end();
+    if (length != sizeof(latest))
+    {
+        l_error(TAG_SESSION, "Unable to write the snapshot");
+        return;
+    }
+
+    saved = latest;
+    savedMs = millis();
+    sessionDirty = false;
+    statsDirty = false;
+    l_debug(TAG_SESSION, "Snapshot saved: %s:%u, session %s, difficulty %.12g", latest.host, latest.port, latest.session_id, latest.difficulty);
+}
+
+/**
+ * Erases the snapshot, the next boot starts a fresh session.
+ */
+void session_clear()
+{
+    if (sessionPreferences.begin(SESSION_NAMESPACE, false))
+    {
+        sessionPreferences.remove(SESSION_KEY);
+        sessionPreferences.end();
+    }
+    latest = SessionSnapshot();
+    saved = SessionSnapshot();
+    sessionDirty = false;
+    statsDirty = false;
+}
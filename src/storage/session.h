@@ -0,0 +1,43 @@
+#ifndef SESSION_H
+#define SESSION_H
+#include <stdint.h>
+
+/**
+ * Snapshot of the pool session kept in flash, so that a restart resumes it at once:
+ * the pool is reached without DNS, the subscription is offered for resumption and the
+ * share target is known before the first set_difficulty.
+ *
+ * Writes are batched: a changed session is written at most every SESSION_SAVE_INTERVAL_MS,
+ * a stats only change every SESSION_CHECKPOINT_INTERVAL_MS. session_save() forces the write
+ * before an intentional restart.
+ */
+#define SESSION_VERSION 1
+#define SESSION_SAVE_INTERVAL_MS 60000
+#define SESSION_CHECKPOINT_INTERVAL_MS (30 * 60000)
+
+// Laid out without padding: it is compared and checksummed byte by byte
+struct SessionSnapshot
+{
+    uint8_t version = SESSION_VERSION;
+    uint8_t reserved[3] = {};
+    // Session
+    uint32_t address = 0; // IPv4 the pool was last reached on, 0 if unknown
+    double difficulty = 0;
+    uint16_t port = 0;
+    uint16_t extranonce2_size = 0;
+    char host[64] = "";
+    char session_id[44] = "";
+    char extranonce1[40] = "";
+    // Stats checkpoint
+    double best_difficulty = 0;
+    uint32_t accepted = 0;
+    uint32_t rejected = 0;
+    uint32_t checksum = 0;
+};
+
+bool session_load(SessionSnapshot &snapshot);
+void session_update(const SessionSnapshot &snapshot);
+void session_loop();
+void session_save();
+void session_clear();
+#endif // SESSION_H
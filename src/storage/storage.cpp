@@ -1,42 +1,258 @@
 #include <Preferences.h>
+#include <string.h>
 #include "storage.h"
 #include "utils/log.h"
+#include "utils/utils.h"
+#include "leafminer.h"
+
+#define STORAGE_KEY "record"
+
+struct StorageHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    uint32_t checksum;
+};
+
+/**
+ * Where a field lives in Configuration, its version 1 key and its default.
+ * Exactly one of text and number is set.
+ */
+struct StorageFieldInfo
+{
+    const char *key;
+    std::string Configuration::*text;
+    int Configuration::*number;
+    const char *text_default;
+    int number_default;
+};
+
+// Indexed by StorageField
+static const StorageFieldInfo fields[STORAGE_FIELDS] = {
+    {"wifi_ssid", &Configuration::wifi_ssid, nullptr, "", 0},
+    {"wifi_password", &Configuration::wifi_password, nullptr, "", 0},
+    {"wallet_address", &Configuration::wallet_address, nullptr, "", 0},
+    {"pool_password", &Configuration::pool_password, nullptr, "", 0},
+    {"pool_url", &Configuration::pool_url, nullptr, "pool.vkbit.com", 0},
+    {"pool_port", nullptr, &Configuration::pool_port, nullptr, 3333},
+    {"pool_fallback", &Configuration::pool_fallback, nullptr, "", 0},
+    {"blink_enabled", &Configuration::blink_enabled, nullptr, "on", 0},
+    {"blink_bright", nullptr, &Configuration::blink_brightness, nullptr, 256},
+    {"lcd_on_start", &Configuration::lcd_on_start, nullptr, "on", 0},
+    {"auto_update", &Configuration::auto_update, nullptr, "on", 0},
+    {"shares_min", nullptr, &Configuration::shares_per_minute, nullptr, SHARES_PER_MINUTE},
+};
 
 Preferences preferences;
 
 const char TAG_STORAGE[13] = "Storage";
 
+// The record as read or last written, storage_getText() points into it
+static uint8_t record[sizeof(StorageHeader) + STORAGE_BODY_SIZE];
+static const uint8_t *values[STORAGE_FIELDS] = {}; // nullptr while a field is not stored
+
 void storage_setup()
 {
     bool success = preferences.begin("config", false);
     l_info(TAG_STORAGE, "Setup: %s", success ? "OK" : "ERROR");
 }
 
+/**
+ * Locates the fields in the body, stopping at the first one it does not fully hold.
+ */
+static void storage_index(size_t length)
+{
+    const uint8_t *body = record + sizeof(StorageHeader);
+    size_t offset = 0;
+    for (uint8_t i = 0; i < STORAGE_FIELDS; i++)
+    {
+        values[i] = nullptr;
+        if (offset >= length)
+        {
+            continue;
+        }
+        if (fields[i].text != nullptr)
+        {
+            const uint8_t *end = static_cast<const uint8_t *>(memchr(body + offset, '\0', length - offset));
+            if (end == nullptr)
+            {
+                offset = length;
+                continue;
+            }
+            values[i] = body + offset;
+            offset = end - body + 1;
+        }
+        else if (offset + sizeof(int32_t) <= length)
+        {
+            values[i] = body + offset;
+            offset += sizeof(int32_t);
+        }
+        else
+        {
+            offset = length;
+        }
+    }
+}
+
+/**
+ * Reads and checks the record.
+ *
+ * @return false if there is none or it does not check out.
+ */
+static bool storage_read()
+{
+    if (!preferences.isKey(STORAGE_KEY))
+    {
+        return false;
+    }
+    const size_t size = preferences.getBytes(STORAGE_KEY, record, sizeof(record));
+    StorageHeader header;
+    memcpy(&header, record, sizeof(header));
+    if (size < sizeof(header) || header.magic != STORAGE_MAGIC || header.length != size - sizeof(header) ||
+        header.checksum != fnv1a(record + sizeof(header), header.length))
+    {
+        l_error(TAG_STORAGE, "Stored configuration is corrupt, using the defaults");
+        storage_index(0);
+        return false;
+    }
+    if (header.version != STORAGE_VERSION)
+    {
+        l_info(TAG_STORAGE, "Configuration from format version %u", header.version);
+    }
+    storage_index(header.length);
+    return true;
+}
+
+/**
+ * Loads a version 1 configuration, one Preferences key per field.
+ */
+static void storage_readKeys(Configuration *conf)
+{
+    for (const StorageFieldInfo &field : fields)
+    {
+        if (field.text != nullptr)
+        {
+            conf->*field.text = preferences.getString(field.key, field.text_default).c_str();
+        }
+        else
+        {
+            conf->*field.number = preferences.getUInt(field.key, field.number_default);
+        }
+    }
+}
+
 void storage_save(const Configuration &conf)
 {
-    preferences.putString("wifi_ssid", conf.wifi_ssid.c_str());
-    preferences.putString("wifi_password", conf.wifi_password.c_str());
-    preferences.putString("wallet_address", conf.wallet_address.c_str());
-    preferences.putString("pool_password", conf.pool_password.c_str());
-    preferences.putString("pool_url", conf.pool_url.c_str());
-    preferences.putUInt("pool_port", conf.pool_port);
-    preferences.putString("blink_enabled", conf.blink_enabled.c_str());
-    preferences.putUInt("blink_bright", conf.blink_brightness);
-    preferences.putString("lcd_on_start", conf.lcd_on_start.c_str());
-    preferences.putString("auto_update", conf.auto_update.c_str());
+    uint8_t *body = record + sizeof(StorageHeader);
+    size_t length = 0;
+    for (const StorageFieldInfo &field : fields)
+    {
+        if (field.text != nullptr)
+        {
+            const std::string &text = conf.*field.text;
+            if (length + text.size() + 1 > STORAGE_BODY_SIZE)
+            {
+                l_error(TAG_STORAGE, "Configuration too large, %s not saved", field.key);
+                break;
+            }
+            memcpy(body + length, text.c_str(), text.size() + 1);
+            length += text.size() + 1;
+        }
+        else
+        {
+            if (length + sizeof(int32_t) > STORAGE_BODY_SIZE)
+            {
+                l_error(TAG_STORAGE, "Configuration too large, %s not saved", field.key);
+                break;
+            }
+            const int32_t number = conf.*field.number;
+            memcpy(body + length, &number, sizeof(number));
+            length += sizeof(number);
+        }
+    }
+
+    const StorageHeader header = {STORAGE_MAGIC, STORAGE_VERSION, (uint16_t)length, fnv1a(body, length)};
+    memcpy(record, &header, sizeof(header));
+    if (preferences.putBytes(STORAGE_KEY, record, sizeof(header) + length) != sizeof(header) + length)
+    {
+        // Any version 1 keys stay, the next boot migrates them again
+        l_error(TAG_STORAGE, "Unable to save the configuration");
+        storage_index(length);
+        preferences.end();
+        return;
+    }
+
+    // The version 1 keys are the only good copy until the record reads back
+    if (!storage_read())
+    {
+        l_error(TAG_STORAGE, "Saved configuration does not read back");
+        preferences.end();
+        return;
+    }
+
+    // The version 1 keys are superseded
+    for (const StorageFieldInfo &field : fields)
+    {
+        if (preferences.isKey(field.key))
+        {
+            preferences.remove(field.key);
+        }
+    }
     preferences.end();
 }
 
 void storage_load(Configuration *conf)
 {
-    conf->wifi_ssid = preferences.getString("wifi_ssid", "").c_str();
-    conf->wifi_password = preferences.getString("wifi_password", "").c_str();
-    conf->wallet_address = preferences.getString("wallet_address", "").c_str();
-    conf->pool_password = preferences.getString("pool_password", "").c_str();
-    conf->pool_url = preferences.getString("pool_url", "pool.vkbit.com").c_str();
-    conf->pool_port = preferences.getUInt("pool_port", 3333);
-    conf->blink_enabled = preferences.getString("blink_enabled", "on").c_str();
-    conf->blink_brightness = preferences.getUInt("blink_bright", 256);
-    conf->lcd_on_start = preferences.getString("lcd_on_start", "on").c_str();
-    conf->auto_update = preferences.getString("auto_update", "on").c_str();
+    if (!storage_read())
+    {
+        storage_readKeys(conf);
+        if (preferences.isKey(fields[STORAGE_WIFI_SSID].key))
+        {
+            l_info(TAG_STORAGE, "Migrating the configuration to format version %u", STORAGE_VERSION);
+            storage_save(*conf);
+            preferences.begin("config", false);
+        }
+        return;
+    }
+
+    for (uint8_t i = 0; i < STORAGE_FIELDS; i++)
+    {
+        const StorageFieldInfo &field = fields[i];
+        if (field.text != nullptr)
+        {
+            conf->*field.text = storage_getText((StorageField)i);
+        }
+        else
+        {
+            conf->*field.number = storage_getNumber((StorageField)i);
+        }
+    }
+}
+
+/**
+ * Reads a text field without copying it.
+ *
+ * @param field A string field.
+ * @return The stored value, or its default if it is not stored. Valid until the next save.
+ */
+const char *storage_getText(StorageField field)
+{
+    return values[field] != nullptr ? reinterpret_cast<const char *>(values[field]) : fields[field].text_default;
+}
+
+/**
+ * Reads a number field.
+ *
+ * @return The stored value, or its default if it is not stored.
+ */
+int32_t storage_getNumber(StorageField field)
+{
+    if (values[field] == nullptr)
+    {
+        return fields[field].number_default;
+    }
+    int32_t number;
+    memcpy(&number, values[field], sizeof(number));
+    return number;
 }
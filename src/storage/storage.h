@@ -1,7 +1,41 @@
 #ifndef STORAGE_H
 #define STORAGE_H
+#include <stdint.h>
 #include "model/configuration.h"
+
+/**
+ * The configuration is stored as one Preferences record:
+ *   U32 STORAGE_MAGIC, U16 format version, U16 body length, U32 FNV-1a of the body
+ * then the fields in StorageField order, strings NUL terminated, numbers as I32.
+ *
+ * Fields are only ever appended: a record written by an older version lacks the last ones,
+ * which keep their defaults. Version 1 was one Preferences key per field, it is migrated on
+ * the first boot.
+ */
+#define STORAGE_MAGIC 0x46434d4c // "LMCF"
+#define STORAGE_VERSION 2
+#define STORAGE_BODY_SIZE 1024
+
+enum StorageField : uint8_t
+{
+    STORAGE_WIFI_SSID,
+    STORAGE_WIFI_PASSWORD,
+    STORAGE_WALLET_ADDRESS,
+    STORAGE_POOL_PASSWORD,
+    STORAGE_POOL_URL,
+    STORAGE_POOL_PORT,
+    STORAGE_POOL_FALLBACK,
+    STORAGE_BLINK_ENABLED,
+    STORAGE_BLINK_BRIGHTNESS,
+    STORAGE_LCD_ON_START,
+    STORAGE_AUTO_UPDATE,
+    STORAGE_SHARES_PER_MINUTE,
+    STORAGE_FIELDS
+};
+
 void storage_setup();
 void storage_save(const Configuration &conf);
 void storage_load(Configuration *conf);
-#endif // STORAGE_H
\ No newline at end of file
+const char *storage_getText(StorageField field);
+int32_t storage_getNumber(StorageField field);
+#endif // STORAGE_H
@@ -0,0 +1,110 @@
+#include <Arduino.h>
+#include "telemetry.h"
+#include "current.h"
+#include "network/pool.h"
+#include "utils/log.h"
+
+char TAG_TELEMETRY[] = "Telemetry";
+
+static TelemetrySample samples[TELEMETRY_SAMPLES];
+// Odd while a sample is being written, sequence / 2 samples were written since boot.
+// Only accessed through __atomic builtins, the fences order the sample copies around it.
+static uint32_t sequence = 0;
+static uint32_t sampledMs = 0;
+
+// Counter values at the previous sample, the samples hold differences
+static uint32_t lastAccepted = 0;
+static uint32_t lastRejected = 0;
+static uint32_t lastStale = 0;
+static uint32_t lastJobs = 0;
+
+static uint16_t telemetry_delta(uint32_t now, uint32_t &last)
+{
+    const uint32_t delta = now - last;
+    last = now;
+    return delta > UINT16_MAX ? UINT16_MAX : delta;
+}
+
+/**
+ * Takes the current counters as the baseline of the next sample, e.g. once they were
+ * restored from the session snapshot: the restored history is not a one minute burst.
+ */
+void telemetry_seed()
+{
+    lastAccepted = current_get_hash_accepted();
+    lastRejected = current_get_hash_rejected();
+    lastStale = current_get_hash_stale();
+    lastJobs = current_get_processedJob();
+}
+
+/**
+ * Takes a sample every TELEMETRY_INTERVAL_MS. Called from the hashrate sampler.
+ */
+void telemetry_loop()
+{
+    if (millis() - sampledMs < TELEMETRY_INTERVAL_MS)
+    {
+        return;
+    }
+    telemetry_sample();
+}
+
+/**
+ * Appends a sample of the current counters, overwriting the oldest one once the buffer is full.
+ */
+void telemetry_sample()
+{
+    sampledMs = millis();
+
+    const uint32_t written = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&sequence, written + 1, __ATOMIC_RELAXED);
+    // The odd sequence is visible before any store to the sample
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    TelemetrySample &sample = samples[(written / 2) % TELEMETRY_SAMPLES];
+    sample.uptime_s = sampledMs / 1000;
+    sample.hashrate = current_get_hashrate();
+    sample.best_difficulty = current_getHighestDifficulty();
+    sample.free_heap = ESP.getFreeHeap();
+    sample.rtt_ms = pool_count() > 0 ? pool_get(pool_getActive()).rtt_ms : POOL_RTT_UNKNOWN;
+    sample.accepted = telemetry_delta(current_get_hash_accepted(), lastAccepted);
+    sample.rejected = telemetry_delta(current_get_hash_rejected(), lastRejected);
+    sample.stale = telemetry_delta(current_get_hash_stale(), lastStale);
+    sample.job_switches = telemetry_delta(current_get_processedJob(), lastJobs);
+    // Publishes the sample: a reader seeing the even sequence sees all of it
+    __atomic_store_n(&sequence, written + 2, __ATOMIC_RELEASE);
+
+    l_debug(TAG_TELEMETRY, "%.2f kH/s, %u/%u/%u shares, %u jobs, %u bytes free", sample.hashrate, sample.accepted,
+            sample.rejected, sample.stale, sample.job_switches, sample.free_heap);
+}
+
+size_t telemetry_count()
+{
+    const uint32_t count = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE) / 2;
+    return count < TELEMETRY_SAMPLES ? count : TELEMETRY_SAMPLES;
+}
+
+/**
+ * Copies a sample, safe to call from another task than the sampler.
+ *
+ * @param age 0 for the newest sample, telemetry_count() - 1 for the oldest.
+ * @param sample Filled with the sample.
+ * @return false if there is no such sample.
+ */
+bool telemetry_get(size_t age, TelemetrySample &sample)
+{
+    // Copy, then make sure no sample was written meanwhile
+    uint32_t before;
+    do
+    {
+        before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE) & ~1u;
+        const uint32_t count = before / 2;
+        if (age >= (count < TELEMETRY_SAMPLES ? count : TELEMETRY_SAMPLES))
+        {
+            return false;
+        }
+        sample = samples[(count - 1 - age) % TELEMETRY_SAMPLES];
+        // The copy completes before the sequence is read again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&sequence, __ATOMIC_RELAXED) != before);
+    return true;
+}
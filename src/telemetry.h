@@ -0,0 +1,37 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Ring buffer of per interval samples, statically allocated: TELEMETRY_SAMPLES x 28 bytes.
+ * Override the size with -DTELEMETRY_SAMPLES=n.
+ */
+#if !defined(TELEMETRY_SAMPLES)
+#if defined(ESP8266)
+#define TELEMETRY_SAMPLES 30
+#else
+#define TELEMETRY_SAMPLES 120
+#endif
+#endif
+#define TELEMETRY_INTERVAL_MS 60000
+
+struct TelemetrySample
+{
+    uint32_t uptime_s = 0;
+    float hashrate = 0;        // kH/s, 1 minute average
+    float best_difficulty = 0; // highest share difficulty since boot
+    uint32_t free_heap = 0;
+    uint32_t rtt_ms = 0;       // active pool, POOL_RTT_UNKNOWN if never measured
+    uint16_t accepted = 0;     // shares over the interval
+    uint16_t rejected = 0;
+    uint16_t stale = 0;
+    uint16_t job_switches = 0;
+};
+
+void telemetry_seed();
+void telemetry_loop();
+void telemetry_sample();
+size_t telemetry_count();
+bool telemetry_get(size_t age, TelemetrySample &sample);
+#endif // TELEMETRY_H
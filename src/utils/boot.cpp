@@ -0,0 +1,76 @@
+#include <Arduino.h>
+#include "boot.h"
+#include "utils/log.h"
+
+char TAG_BOOT[] = "Boot";
+static BootTiming timings[BOOT_PHASES];
+
+void boot_begin(BootPhase phase)
+{
+    timings[phase].start_ms = millis();
+    timings[phase].end_ms = 0;
+}
+
+/**
+ * Marks the end of a phase, only its first end counts. Ending BOOT_FIRST_HASH logs the report.
+ */
+void boot_end(BootPhase phase)
+{
+    if (timings[phase].end_ms != 0)
+    {
+        return;
+    }
+    timings[phase].end_ms = millis();
+    if (phase == BOOT_FIRST_HASH)
+    {
+        boot_report();
+    }
+}
+
+const BootTiming &boot_timing(BootPhase phase)
+{
+    return timings[phase];
+}
+
+const char *boot_phaseName(BootPhase phase)
+{
+    switch (phase)
+    {
+    case BOOT_STORAGE:
+        return "storage";
+    case BOOT_WIFI:
+        return "wifi";
+    case BOOT_SPLASH:
+        return "splash";
+    case BOOT_AUTOUPDATE:
+        return "autoupdate";
+    case BOOT_POOL:
+        return "pool";
+    case BOOT_FIRST_HASH:
+        return "first_hash";
+    case BOOT_PHASES:
+        break;
+    }
+    return "unknown";
+}
+
+/**
+ * Logs when each phase started and ended, phases still running are reported as such.
+ */
+void boot_report()
+{
+    for (uint8_t i = 0; i < BOOT_PHASES; i++)
+    {
+        const BootTiming &timing = timings[i];
+        if (timing.end_ms == 0)
+        {
+            if (timing.start_ms != 0)
+            {
+                l_info(TAG_BOOT, "%s: started at %u ms, still running", boot_phaseName((BootPhase)i), timing.start_ms);
+            }
+            continue;
+        }
+        l_info(TAG_BOOT, "%s: %u -> %u ms (%u ms)", boot_phaseName((BootPhase)i), timing.start_ms, timing.end_ms,
+               timing.end_ms - timing.start_ms);
+    }
+}
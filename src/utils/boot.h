@@ -0,0 +1,31 @@
+#ifndef BOOT_H
+#define BOOT_H
+#include <stdint.h>
+
+/**
+ * Boot phase timings, in milliseconds since power on. Phases may overlap: WiFi associates
+ * while the splash screen shows. The report is logged once the first hash is counted.
+ */
+enum BootPhase : uint8_t
+{
+    BOOT_STORAGE,    // configuration load
+    BOOT_WIFI,       // WiFi association, in the background
+    BOOT_SPLASH,     // splash screen or start blink
+    BOOT_AUTOUPDATE, // update check, in the background on ESP32
+    BOOT_POOL,       // pool connection up to the first job
+    BOOT_FIRST_HASH, // from power on to the first hashes counted
+    BOOT_PHASES
+};
+
+struct BootTiming
+{
+    uint32_t start_ms = 0;
+    uint32_t end_ms = 0; // 0 while the phase runs or if it never ran
+};
+
+void boot_begin(BootPhase phase);
+void boot_end(BootPhase phase);
+const BootTiming &boot_timing(BootPhase phase);
+const char *boot_phaseName(BootPhase phase);
+void boot_report();
+#endif // BOOT_H
@@ -0,0 +1,124 @@
+#if defined(PROBES) || defined(TRACE)
+#include <Arduino.h>
+#if !defined(ESP8266) && !defined(ESP32)
+#include <time.h>
+#endif
+#include "probe.h"
+#include "utils/log.h"
+
+#define PROBE_REPORT_INTERVAL_MS 60000
+
+#if defined(PROBES)
+char TAG_PROBE[] = "Probe";
+
+// Written by every probe site without locking: two miner tasks may lose a count, never corrupt one
+static ProbeHistogram histograms[PROBE_COUNT];
+
+/**
+ * @return The free running cycle counter: CCOUNT on Xtensa, nanoseconds on a host build.
+ */
+uint32_t probe_now()
+{
+#if defined(ESP8266) || defined(ESP32)
+    return ESP.getCycleCount();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+#endif
+}
+
+void probe_record(ProbeId probe, uint32_t cycles)
+{
+    ProbeHistogram &histogram = histograms[probe];
+    histogram.count++;
+    histogram.cycles += cycles;
+    if (cycles > histogram.max_cycles)
+    {
+        histogram.max_cycles = cycles;
+    }
+    histogram.buckets[cycles == 0 ? 0 : 31 - __builtin_clz(cycles)]++;
+}
+
+const ProbeHistogram &probe_histogram(ProbeId probe)
+{
+    return histograms[probe];
+}
+
+void probe_reset()
+{
+    for (ProbeHistogram &histogram : histograms)
+    {
+        histogram = ProbeHistogram();
+    }
+}
+
+/**
+ * Logs every probe that ran: count, mean and max cycles, then the non empty buckets as
+ * "log2:count" pairs.
+ */
+void probe_report()
+{
+    for (uint8_t i = 0; i < PROBE_COUNT; i++)
+    {
+        const ProbeHistogram &histogram = histograms[i];
+        if (histogram.count == 0)
+        {
+            continue;
+        }
+
+        char buckets[PROBE_BUCKETS * 16] = "";
+        size_t length = 0;
+        for (uint8_t b = 0; b < PROBE_BUCKETS && length < sizeof(buckets); b++)
+        {
+            if (histogram.buckets[b] > 0)
+            {
+                length += snprintf(buckets + length, sizeof(buckets) - length, " %u:%u", b, histogram.buckets[b]);
+            }
+        }
+        l_info(TAG_PROBE, "%s: n=%u mean=%u max=%u |%s", probe_name((ProbeId)i), histogram.count,
+               (uint32_t)(histogram.cycles / histogram.count), histogram.max_cycles, buckets);
+    }
+}
+
+/**
+ * Reports the histograms every PROBE_REPORT_INTERVAL_MS.
+ */
+void probe_loop()
+{
+    static uint32_t reportedMs = 0;
+    if (millis() - reportedMs < PROBE_REPORT_INTERVAL_MS)
+    {
+        return;
+    }
+    reportedMs = millis();
+    probe_report();
+}
+#endif // PROBES
+
+const char *probe_name(ProbeId probe)
+{
+    switch (probe)
+    {
+    case PROBE_MINER_SLICE:
+        return "miner_slice";
+    case PROBE_JOB_BUILD:
+        return "job_build";
+    case PROBE_RESPONSE:
+        return "response";
+    case PROBE_REQUEST:
+        return "request";
+    case PROBE_SOCKET_WRITE:
+        return "socket_write";
+    case PROBE_SCREEN:
+        return "screen";
+    case PROBE_NETWORK_POLL:
+        return "network_poll";
+    case PROBE_SUBMIT:
+        return "submit";
+    case PROBE_COUNT:
+        break;
+    }
+    return "unknown";
+}
+#endif // PROBES || TRACE
@@ -0,0 +1,99 @@
+#ifndef PROBE_H
+#define PROBE_H
+#include <stdint.h>
+
+/**
+ * Cycle count probes around the hot paths, enabled with the PROBES build flag.
+ * Each probe feeds a log2 histogram: bucket n counts the runs that took [2^n, 2^(n+1)) cycles.
+ * Without the flag PROBE_SCOPE() and probe_loop() compile to nothing, and so does the
+ * histogram storage. The TRACE build flag also turns PROBE_SCOPE() on, and records every
+ * scope as a trace span; the histograms are only kept with PROBES.
+ */
+#define PROBE_BUCKETS 32
+
+enum ProbeId : uint8_t
+{
+    PROBE_MINER_SLICE,  // one miner() call: a hashing time slice, then the submit of its share
+    PROBE_JOB_BUILD,    // Job construction from a notify
+    PROBE_RESPONSE,     // parsing and handling one pool line
+    PROBE_REQUEST,      // queueing one outbound line
+    PROBE_SOCKET_WRITE, // writing the queued lines to the socket
+    PROBE_SCREEN,       // one screen refresh
+    PROBE_NETWORK_POLL, // one pass of network_listen()
+    PROBE_SUBMIT,       // building and queueing a share
+    PROBE_COUNT
+};
+
+struct ProbeHistogram
+{
+    uint32_t count = 0;
+    uint64_t cycles = 0;
+    uint32_t max_cycles = 0;
+    uint32_t buckets[PROBE_BUCKETS] = {};
+};
+
+#if defined(PROBES)
+uint32_t probe_now();
+void probe_record(ProbeId probe, uint32_t cycles);
+const ProbeHistogram &probe_histogram(ProbeId probe);
+void probe_reset();
+void probe_report();
+#endif // PROBES
+
+#if defined(TRACE)
+#include "trace.h"
+#endif // TRACE
+
+#if defined(PROBES) || defined(TRACE)
+const char *probe_name(ProbeId probe);
+
+/**
+ * Records the cycles spent between its construction and the end of the enclosing scope,
+ * and with TRACE the span it covers.
+ */
+class ProbeScope
+{
+public:
+    explicit ProbeScope(ProbeId probe) : probe(probe)
+    {
+#if defined(PROBES)
+        start = probe_now();
+#endif // PROBES
+#if defined(TRACE)
+        start_us = trace_now();
+#endif // TRACE
+    }
+    ~ProbeScope()
+    {
+#if defined(PROBES)
+        probe_record(probe, probe_now() - start);
+#endif // PROBES
+#if defined(TRACE)
+        trace_span(probe, start_us, trace_now());
+#endif // TRACE
+    }
+
+private:
+    ProbeId probe;
+#if defined(PROBES)
+    uint32_t start;
+#endif // PROBES
+#if defined(TRACE)
+    uint32_t start_us;
+#endif // TRACE
+};
+
+#define PROBE_CONCAT_(a, b) a##b
+#define PROBE_CONCAT(a, b) PROBE_CONCAT_(a, b)
+#define PROBE_SCOPE(probe) ProbeScope PROBE_CONCAT(probe_scope_, __LINE__)(probe)
+#else
+#define PROBE_SCOPE(probe) ((void)0)
+#endif // PROBES || TRACE
+
+#if defined(PROBES)
+void probe_loop();
+#else
+#define probe_loop() ((void)0)
+#endif // PROBES
+
+#endif // PROBE_H
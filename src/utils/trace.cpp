@@ -0,0 +1,336 @@
+#if defined(TRACE)
+#include <Arduino.h>
+#if defined(ESP8266) || defined(ESP32)
+#include <LittleFS.h>
+#else
+#include <stdio.h>
+#include <time.h>
+#include <mutex>
+#endif
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#include "trace.h"
+#include "probe.h"
+#include "network/network.h"
+#include "utils/log.h"
+
+#define TRACE_THREADS 8       // threads named in the file
+#define TRACE_FLUSH_CHUNK 16  // events copied out per lock
+#define TRACE_LINE_SIZE 192
+
+struct TraceEvent
+{
+    uint32_t start_us;
+    uint32_t duration_us;
+    uint32_t thread;
+    uint32_t generation;
+    uint8_t probe;
+};
+
+char TAG_TRACE[] = "Trace";
+
+// Filled by every task running a probe, emptied by trace_loop()
+static TraceEvent events[TRACE_EVENTS];
+static uint32_t reserved = 0; // events buffered since the start
+static uint32_t flushed = 0;  // events taken out of the buffer
+static uint32_t dropped = 0;  // events lost to a full buffer
+
+// Owned by trace_loop()
+static bool traceActive = false;
+static uint32_t traceBytes = 0;
+static uint32_t traceSyncedBytes = 0;
+static uint32_t traceSyncedMs = 0;
+static uint32_t traceStartUs = 0;
+static uint32_t traceLastUs = 0;
+static uint64_t traceClockUs = 0; // microseconds since the start, past the 32 bit wrap
+static uint32_t threads[TRACE_THREADS];
+static uint8_t threadCount = 0;
+
+#if defined(ESP32)
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+#define TRACE_LOCK() portENTER_CRITICAL(&traceMux)
+#define TRACE_UNLOCK() portEXIT_CRITICAL(&traceMux)
+#elif defined(ESP8266)
+// Probes only run on the loop task
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#else
+static std::mutex traceMutex;
+#define TRACE_LOCK() traceMutex.lock()
+#define TRACE_UNLOCK() traceMutex.unlock()
+#endif
+
+#if defined(ESP8266) || defined(ESP32)
+static File traceFile;
+#else
+static FILE *traceFile = nullptr;
+#endif
+
+static bool trace_open(const char *path)
+{
+#if defined(ESP8266) || defined(ESP32)
+#if defined(ESP8266)
+    if (!LittleFS.begin())
+#else
+    if (!LittleFS.begin(true)) // format on first use
+#endif
+    {
+        l_error(TAG_TRACE, "Unable to mount the filesystem");
+        return false;
+    }
+    traceFile = LittleFS.open(path, "w");
+    return (bool)traceFile;
+#else
+    traceFile = fopen(path, "w");
+    return traceFile != nullptr;
+#endif
+}
+
+static void trace_write(const char *text, size_t length)
+{
+#if defined(ESP8266) || defined(ESP32)
+    traceFile.write(reinterpret_cast<const uint8_t *>(text), length);
+#else
+    fwrite(text, 1, length, traceFile);
+#endif
+    traceBytes += length;
+}
+
+/**
+ * Commits what was written so far, LittleFS only keeps it past a reset once synced.
+ */
+static void trace_sync()
+{
+#if defined(ESP8266) || defined(ESP32)
+    traceFile.flush();
+#else
+    fflush(traceFile);
+#endif
+    traceSyncedBytes = traceBytes;
+    traceSyncedMs = millis();
+}
+
+static void trace_close()
+{
+#if defined(ESP8266) || defined(ESP32)
+    traceFile.close();
+#else
+    fclose(traceFile);
+    traceFile = nullptr;
+#endif
+}
+
+static uint32_t trace_thread()
+{
+#if defined(ESP32)
+    return (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+#elif defined(ESP8266)
+    return 1;
+#else
+    static uint32_t next = 0;
+    static thread_local uint32_t thread = 0;
+    if (thread == 0)
+    {
+        thread = __atomic_add_fetch(&next, 1, __ATOMIC_RELAXED);
+    }
+    return thread;
+#endif
+}
+
+/**
+ * Names a thread the first time one of its spans is written, so that the viewer shows the
+ * miner workers and the network task by name.
+ */
+static void trace_nameThread(uint32_t thread)
+{
+    for (uint8_t i = 0; i < threadCount; i++)
+    {
+        if (threads[i] == thread)
+        {
+            return;
+        }
+    }
+    if (threadCount == TRACE_THREADS)
+    {
+        return;
+    }
+    threads[threadCount++] = thread;
+
+    char name[16];
+#if defined(ESP32)
+    snprintf(name, sizeof(name), "%s", pcTaskGetName((TaskHandle_t)(uintptr_t)thread));
+#elif defined(ESP8266)
+    snprintf(name, sizeof(name), "loop");
+#else
+    snprintf(name, sizeof(name), "thread %u", thread);
+#endif
+    char line[TRACE_LINE_SIZE];
+    const int length = snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n", thread, name);
+    trace_write(line, length);
+}
+
+static void trace_writeEvent(const TraceEvent &event)
+{
+    trace_nameThread(event.thread);
+
+    // Spans are buffered as they end, so starts may go back a little: the signed difference keeps the clock right
+    traceClockUs += (int32_t)(event.start_us - traceLastUs);
+    traceLastUs = event.start_us;
+
+    char line[TRACE_LINE_SIZE];
+    const int length = snprintf(line, sizeof(line),
+                                "{\"name\":\"%s\",\"cat\":\"leafminer\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%u,\"args\":{\"generation\":%u}},\n",
+                                probe_name((ProbeId)event.probe), (unsigned long long)traceClockUs, event.duration_us, event.thread, event.generation);
+    trace_write(line, length);
+}
+
+static void trace_drain()
+{
+    TraceEvent chunk[TRACE_FLUSH_CHUNK];
+    size_t count;
+    do
+    {
+        TRACE_LOCK();
+        count = 0;
+        while (flushed != reserved && count < TRACE_FLUSH_CHUNK)
+        {
+            chunk[count++] = events[flushed % TRACE_EVENTS];
+            flushed++;
+        }
+        TRACE_UNLOCK();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            trace_writeEvent(chunk[i]);
+        }
+    } while (count == TRACE_FLUSH_CHUNK);
+}
+
+/**
+ * Starts writing a new trace, spans are buffered from now on.
+ *
+ * @param path The file to write, replaced if it exists.
+ * @return false if the file could not be created.
+ */
+bool trace_start(const char *path)
+{
+    trace_stop();
+    if (!trace_open(path))
+    {
+        l_error(TAG_TRACE, "Unable to create %s", path);
+        return false;
+    }
+
+    traceBytes = 0;
+    traceSyncedBytes = 0;
+    traceSyncedMs = millis();
+    threadCount = 0;
+    traceStartUs = trace_now();
+    traceLastUs = traceStartUs;
+    traceClockUs = 0;
+    trace_write("[\n", 2);
+    TRACE_LOCK();
+    flushed = reserved;
+    dropped = 0;
+    traceActive = true;
+    TRACE_UNLOCK();
+    l_info(TAG_TRACE, "Tracing to %s", path);
+    return true;
+}
+
+/**
+ * Writes the buffered spans and closes the array.
+ */
+void trace_stop()
+{
+    if (!traceActive)
+    {
+        return;
+    }
+    TRACE_LOCK();
+    traceActive = false;
+    TRACE_UNLOCK();
+    trace_drain();
+
+    char line[TRACE_LINE_SIZE];
+    const int length = snprintf(line, sizeof(line), "{\"name\":\"trace_stop\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%llu,\"pid\":1,\"tid\":0,\"args\":{\"dropped\":%u}}\n]\n",
+                                (unsigned long long)(traceClockUs + (int32_t)(trace_now() - traceLastUs)), dropped);
+    trace_write(line, length);
+    trace_close();
+    l_info(TAG_TRACE, "Trace stopped, %u bytes, %u spans dropped", traceBytes, dropped);
+}
+
+bool trace_isActive()
+{
+    return traceActive;
+}
+
+/**
+ * @return Microseconds from a free running clock, the trace timestamps.
+ */
+uint32_t trace_now()
+{
+#if defined(ESP8266) || defined(ESP32)
+    return micros();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000ULL + now.tv_nsec / 1000);
+#endif
+}
+
+/**
+ * Buffers one span, dropped if trace_loop() has fallen TRACE_EVENTS spans behind.
+ * A span that began before trace_start() is left out, its timestamp would be negative.
+ */
+void trace_span(uint8_t probe, uint32_t start_us, uint32_t end_us)
+{
+    if (!traceActive || (int32_t)(start_us - traceStartUs) < 0)
+    {
+        return;
+    }
+    const uint32_t thread = trace_thread();
+    const uint32_t generation = network_getJobGeneration();
+
+    TRACE_LOCK();
+    if (reserved - flushed >= TRACE_EVENTS)
+    {
+        dropped++;
+    }
+    else
+    {
+        TraceEvent &event = events[reserved % TRACE_EVENTS];
+        event.start_us = start_us;
+        event.duration_us = end_us - start_us;
+        event.thread = thread;
+        event.generation = generation;
+        event.probe = probe;
+        reserved++;
+    }
+    TRACE_UNLOCK();
+}
+
+/**
+ * Writes the buffered spans and syncs the file every TRACE_SYNC_MS, stops the trace once
+ * it reaches TRACE_MAX_BYTES. Called from network_listen(), so the flash writes do not
+ * show up in the miner slices they record.
+ */
+void trace_loop()
+{
+    if (!traceActive)
+    {
+        return;
+    }
+    trace_drain();
+    if (traceBytes >= TRACE_MAX_BYTES)
+    {
+        trace_stop();
+    }
+    else if (traceBytes != traceSyncedBytes && millis() - traceSyncedMs >= TRACE_SYNC_MS)
+    {
+        trace_sync();
+    }
+}
+#endif // TRACE
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+
+/**
+ * Timeline of the PROBE_SCOPE() spans, enabled with the TRACE build flag.
+ *
+ * Spans are buffered in RAM by the task that ran them and written by trace_loop(), on the
+ * network task, as a Chrome trace-event JSON array, which chrome://tracing and
+ * ui.perfetto.dev both open. Each span is a complete ("X") event on the thread that ran it,
+ * with the job generation it ran under in its args. The file is synced every
+ * TRACE_SYNC_MS: a reset loses at most the spans of that last interval, and the file
+ * stays readable since the closing bracket is optional in this format.
+ * Without the flag nothing is compiled and trace_loop() is a no-op.
+ */
+#if defined(ESP8266) || defined(ESP32)
+#define TRACE_PATH "/trace.json"
+#else
+#define TRACE_PATH "trace.json"
+#endif
+
+#ifndef TRACE_EVENTS
+#if defined(ESP8266)
+#define TRACE_EVENTS 256
+#elif defined(ESP32)
+#define TRACE_EVENTS 512
+#else
+#define TRACE_EVENTS 4096
+#endif
+#endif // TRACE_EVENTS
+
+#ifndef TRACE_SYNC_MS
+#define TRACE_SYNC_MS 1000
+#endif // TRACE_SYNC_MS
+
+#ifndef TRACE_MAX_BYTES
+#define TRACE_MAX_BYTES (512 * 1024)
+#endif // TRACE_MAX_BYTES
+
+bool trace_start(const char *path);
+void trace_stop();
+bool trace_isActive();
+uint32_t trace_now();
+void trace_span(uint8_t probe, uint32_t start_us, uint32_t end_us);
+
+#if defined(TRACE)
+void trace_loop();
+#else
+#define trace_loop() ((void)0)
+#endif // TRACE
+#endif // TRACE_H
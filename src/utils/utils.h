@@ -177,4 +177,38 @@ static double diff_from_target(const uint8_t *hash)
     return ds;
 }
 
+/**
+ * Calculates the share difficulty that makes a miner find the given number of shares per minute.
+ * A difficulty 1 share takes 2^32 hashes on average.
+ *
+ * @param hashrate The effective hashrate in H/s.
+ * @param shares_per_minute The wanted share rate.
+ * @return The difficulty, or 0 if it cannot be computed.
+ */
+static inline double difficulty_for_share_rate(double hashrate, double shares_per_minute)
+{
+    if (hashrate <= 0 || shares_per_minute <= 0)
+    {
+        return 0;
+    }
+    return (hashrate * 60.0) / (shares_per_minute * 4294967296.0);
+}
+
+/**
+ * FNV-1a hash, the checksum of the records kept in flash.
+ *
+ * @param bytes The data.
+ * @param length The data length.
+ * @return The 32-bit hash.
+ */
+static inline uint32_t fnv1a(const uint8_t *bytes, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,622 @@
+#include <Arduino.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <cJSON.h>
+#include "mock_pool.h"
+#include "network/network.h"
+#include "network/sv2.h"
+#include "model/block.h"
+#include "utils/utils.h"
+#include "miner/sha256m.h"
+
+#define MOCK_POOL_EXTRANONCE2_SIZE 4
+#define MOCK_POOL_LINE_SIZE 1024
+
+/**
+ * A job as announced by the mock pool, kept until the next block so that
+ * shares can be checked against it.
+ */
+struct MockJob
+{
+    std::string id;
+    std::string prevhash;
+    double difficulty;
+    uint32_t sent_ms;
+    bool has_share;
+    std::string merkle_root; // Stratum V2 only, 32 bytes
+};
+
+/**
+ * A reply waiting for the scripted latency before being delivered to the client.
+ */
+struct MockReply
+{
+    uint32_t due_ms;
+    std::string line; // a whole frame in Stratum V2 mode
+    uint32_t submit_ms; // non zero for accepted submits, to measure the accept latency
+};
+
+/**
+ * Stratum V2 frame built by the mock pool, little endian as on the wire.
+ */
+struct MockFrame
+{
+    std::string bytes;
+
+    MockFrame(uint8_t msg_type, bool channel) : bytes(SV2_HEADER_SIZE, '\0')
+    {
+        bytes[1] = channel ? (char)(SV2_CHANNEL_BIT >> 8) : 0;
+        bytes[2] = (char)msg_type;
+    }
+    void u8(uint8_t v) { bytes.push_back((char)v); }
+    void u16(uint16_t v)
+    {
+        u8((uint8_t)v);
+        u8((uint8_t)(v >> 8));
+    }
+    void u32(uint32_t v)
+    {
+        u16((uint16_t)v);
+        u16((uint16_t)(v >> 16));
+    }
+    void raw(const void *data, size_t n) { bytes.append(static_cast<const char *>(data), n); }
+    const std::string &finish()
+    {
+        const size_t length = bytes.size() - SV2_HEADER_SIZE;
+        bytes[3] = (char)length;
+        bytes[4] = (char)(length >> 8);
+        bytes[5] = (char)(length >> 16);
+        return bytes;
+    }
+};
+
+// Block template, same coinbase as https://bitcoin.stackexchange.com/questions/22929
+static const char *MOCK_COINB1 = "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff270362f401062f503253482f049b8f175308";
+static const char *MOCK_COINB2 = "0d2f7374726174756d506f6f6c2f000000000100868591052100001976a91431482118f1d7504daf1c001cbfaf91ad580d176d88ac00000000";
+static const char *MOCK_BRANCH1 = "57351e8569cb9d036187a79fd1844fd930c1309efcd16c46af9bb9713b6ee734";
+static const char *MOCK_BRANCH2 = "936ab9c33420f187acae660fcdb07ffdffa081273674f0f41e6ecc1347451d23";
+static const char *MOCK_PREVHASH = "7dcf1304b04e79024066cd9481aa464e2fe17966e19edf6f33970e1fe0b60277";
+static const char *MOCK_VERSION = "00000002";
+static const char *MOCK_NBITS = "1b44dfdb";
+static const char *MOCK_NTIME = "53178f9b";
+
+static const MockPoolEvent *schedule = nullptr;
+static size_t scheduleCount = 0;
+static size_t scheduleNext = 0;
+static uint32_t startMs = 0;
+static uint32_t latencyMs = 0;
+static double difficulty = 1;
+static uint32_t blockHeight = 0;
+static uint32_t jobCounter = 0;
+static uint32_t sessionCounter = 0;
+static std::string sessionId = "";
+static std::string extranonce1 = "";
+static bool authorized = false;
+static bool resumed = false;
+static std::vector<MockJob> jobs;
+static std::vector<MockReply> replies;
+static MockPoolStats stats;
+// Stratum V2 mode
+static bool sv2 = false;
+static Sv2Decoder sv2Decoder;
+static uint32_t channelId = 0;
+
+static void mock_pool_reply(const std::string &line, uint32_t submit_ms = 0)
+{
+    replies.push_back({millis() + latencyMs, line, submit_ms});
+}
+
+static uint32_t mock_pool_u32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+/**
+ * Encodes a share difficulty as a U256 target, and takes back the difficulty the client
+ * reads from it so that both sides check shares against the same value.
+ */
+static double mock_pool_target(double value, uint8_t *target)
+{
+    double remaining = TRUEDIFFONE / value;
+    for (int i = 31; i >= 0; --i)
+    {
+        const double unit = ldexp(1.0, 8 * i);
+        const double byte = floor(remaining / unit);
+        target[i] = byte > 255 ? 255 : (uint8_t)byte;
+        remaining -= target[i] * unit;
+    }
+    return TRUEDIFFONE / littleEndian256ToDouble(target);
+}
+
+static void mock_pool_setDifficulty(double value)
+{
+    char line[MOCK_POOL_LINE_SIZE];
+    difficulty = value;
+    if (sv2)
+    {
+        uint8_t target[32];
+        difficulty = mock_pool_target(value, target);
+        MockFrame frame(SV2_SET_TARGET, true);
+        frame.u32(channelId);
+        frame.raw(target, sizeof(target));
+        mock_pool_reply(frame.finish());
+        return;
+    }
+    snprintf(line, sizeof(line), "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.12g]}", difficulty);
+    mock_pool_reply(line);
+}
+
+/**
+ * The header fields of a job as the client puts them in its block header.
+ */
+static void mock_pool_header(const MockJob &job, Block &block)
+{
+    block.version = strtoul(MOCK_VERSION, nullptr, 16);
+    hexStringToByteArray(job.prevhash.c_str(), block.previous_block);
+    reverseBytesAndFlip(block.previous_block, 32);
+    block.nbits = strtoul(MOCK_NBITS, nullptr, 16);
+}
+
+/**
+ * Announces a Stratum V2 job. The pool computes the merkle root, here any value unique
+ * to the job does. A new block comes as a future job activated by SetNewPrevHash.
+ */
+static void mock_pool_newMiningJob(MockJob &job, bool clean)
+{
+    uint8_t merkle[SHA256M_BUFFER_SIZE];
+    sha256_double(reinterpret_cast<const uint8_t *>(job.id.c_str()), job.id.length(), merkle);
+    job.merkle_root.assign(reinterpret_cast<const char *>(merkle), 32);
+
+    Block block;
+    mock_pool_header(job, block);
+    const uint32_t jobId = strtoul(job.id.c_str(), nullptr, 10);
+    const uint32_t ntime = strtoul(MOCK_NTIME, nullptr, 16);
+
+    MockFrame newJob(SV2_NEW_MINING_JOB, true);
+    newJob.u32(channelId);
+    newJob.u32(jobId);
+    newJob.u8(clean ? 0 : 1);
+    if (!clean)
+    {
+        newJob.u32(ntime);
+    }
+    newJob.u32(block.version);
+    newJob.raw(merkle, 32);
+    mock_pool_reply(newJob.finish());
+
+    if (clean)
+    {
+        MockFrame prevHash(SV2_SET_NEW_PREV_HASH, true);
+        prevHash.u32(channelId);
+        prevHash.u32(jobId);
+        prevHash.raw(block.previous_block, 32);
+        prevHash.u32(ntime);
+        prevHash.u32(block.nbits);
+        mock_pool_reply(prevHash.finish());
+    }
+}
+
+static void mock_pool_notify(bool clean)
+{
+    if (clean || jobs.empty())
+    {
+        blockHeight++;
+        jobs.clear();
+    }
+
+    char prevhash[65];
+    snprintf(prevhash, sizeof(prevhash), "%08x%s", blockHeight, MOCK_PREVHASH + 8);
+    char id[16];
+    snprintf(id, sizeof(id), sv2 ? "%u" : "%x", ++jobCounter);
+    jobs.push_back({id, prevhash, difficulty, millis() + latencyMs, false, ""});
+
+    if (sv2)
+    {
+        mock_pool_newMiningJob(jobs.back(), clean);
+        stats.notifies++;
+        return;
+    }
+
+    char line[MOCK_POOL_LINE_SIZE];
+    snprintf(line, sizeof(line), "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"%s\",\"%s\",\"%s\",\"%s\",[\"%s\",\"%s\"],\"%s\",\"%s\",\"%s\",%s]}",
+             id, prevhash, MOCK_COINB1, MOCK_COINB2, MOCK_BRANCH1, MOCK_BRANCH2, MOCK_VERSION, MOCK_NBITS, MOCK_NTIME, clean ? "true" : "false");
+    mock_pool_reply(line);
+    stats.notifies++;
+}
+
+/**
+ * Rebuilds the block header of a share exactly as a pool would and hashes it.
+ *
+ * @return The difficulty of the share hash.
+ */
+static double mock_pool_shareDifficulty(const MockJob &job, const char *extranonce2, const char *ntime, const char *nonce)
+{
+    const std::string coinbase = std::string(MOCK_COINB1) + extranonce1 + extranonce2 + MOCK_COINB2;
+    std::vector<uint8_t> coinbaseBytes(coinbase.length() / 2);
+    hexStringToByteArray(coinbase.c_str(), coinbaseBytes.data());
+
+    uint8_t merkle[SHA256M_BUFFER_SIZE];
+    uint8_t concatenated[SHA256M_BLOCK_SIZE * 2];
+    sha256_double(coinbaseBytes.data(), coinbaseBytes.size(), merkle);
+    const char *branches[] = {MOCK_BRANCH1, MOCK_BRANCH2};
+    for (const char *branch : branches)
+    {
+        memcpy(concatenated, merkle, SHA256M_BLOCK_SIZE);
+        hexStringToByteArray(branch, concatenated + SHA256M_BLOCK_SIZE);
+        sha256_double(concatenated, sizeof(concatenated), merkle);
+    }
+
+    Block block;
+    mock_pool_header(job, block);
+    memcpy(block.merkle_root, merkle, 32);
+    block.ntime = strtoul(ntime, nullptr, 16);
+    block.nonce = strtoul(nonce, nullptr, 16);
+
+    uint8_t hash[SHA256M_BUFFER_SIZE];
+    sha256_double(reinterpret_cast<uint8_t *>(&block), sizeof(block), hash);
+    return diff_from_target(hash);
+}
+
+static void mock_pool_firstShare(MockJob &job)
+{
+    if (!job.has_share)
+    {
+        job.has_share = true;
+        stats.first_share_ms_total += millis() - job.sent_ms;
+        stats.first_share_count++;
+    }
+}
+
+static void mock_pool_submit(uint64_t id, const cJSON *params)
+{
+    char line[MOCK_POOL_LINE_SIZE];
+    stats.submitted++;
+
+    if (!authorized)
+    {
+        stats.unauthorized++;
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":null,\"error\":[24,\"Unauthorized worker\",null]}", id);
+        mock_pool_reply(line);
+        return;
+    }
+
+    const char *jobId = cJSON_GetStringValue(cJSON_GetArrayItem(params, 1));
+    const char *extranonce2 = cJSON_GetStringValue(cJSON_GetArrayItem(params, 2));
+    const char *ntime = cJSON_GetStringValue(cJSON_GetArrayItem(params, 3));
+    const char *nonce = cJSON_GetStringValue(cJSON_GetArrayItem(params, 4));
+
+    MockJob *job = nullptr;
+    for (MockJob &candidate : jobs)
+    {
+        if (jobId != nullptr && candidate.id == jobId)
+        {
+            job = &candidate;
+        }
+    }
+
+    if (job == nullptr || extranonce2 == nullptr || ntime == nullptr || nonce == nullptr)
+    {
+        stats.stale++;
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":null,\"error\":[21,\"Job not found\",null]}", id);
+        mock_pool_reply(line);
+        return;
+    }
+
+    mock_pool_firstShare(*job);
+
+    // The client may apply a new difficulty before or after the job, accept both
+    const double required = job->difficulty < difficulty ? job->difficulty : difficulty;
+    if (mock_pool_shareDifficulty(*job, extranonce2, ntime, nonce) < required)
+    {
+        stats.low_difficulty++;
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":null,\"error\":[23,\"Low difficulty share\",null]}", id);
+        mock_pool_reply(line);
+        return;
+    }
+
+    snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":true,\"error\":null}", id);
+    mock_pool_reply(line, millis());
+}
+
+/**
+ * Handles one line sent by the client (loopback of request()).
+ */
+static void mock_pool_receive(const char *payload)
+{
+    cJSON *json = cJSON_Parse(payload);
+    if (json == nullptr)
+    {
+        return;
+    }
+
+    const cJSON *idJson = cJSON_GetObjectItem(json, "id");
+    const uint64_t id = cJSON_IsNumber(idJson) ? (uint64_t)idJson->valuedouble : 0;
+    const char *method = cJSON_GetStringValue(cJSON_GetObjectItem(json, "method"));
+    const cJSON *params = cJSON_GetObjectItem(json, "params");
+    char line[MOCK_POOL_LINE_SIZE];
+
+    if (method == nullptr)
+    {
+        // Not a request, nothing to answer
+    }
+    else if (strcmp(method, "mining.subscribe") == 0)
+    {
+        // Resume the session when the client offers the current id
+        const char *offered = cJSON_GetStringValue(cJSON_GetArrayItem(params, 1));
+        resumed = offered != nullptr && sessionId == offered;
+        if (!resumed)
+        {
+            char buffer[16];
+            snprintf(buffer, sizeof(buffer), "%08x", ++sessionCounter);
+            sessionId = buffer;
+            snprintf(buffer, sizeof(buffer), "f800%04x", sessionCounter);
+            extranonce1 = buffer;
+        }
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":[[[\"mining.set_difficulty\",\"%s\"],[\"mining.notify\",\"%s\"]],\"%s\",%d],\"error\":null}",
+                 id, sessionId.c_str(), sessionId.c_str(), extranonce1.c_str(), MOCK_POOL_EXTRANONCE2_SIZE);
+        mock_pool_reply(line);
+    }
+    else if (strcmp(method, "mining.authorize") == 0)
+    {
+        const bool first = !authorized;
+        authorized = true;
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":true,\"error\":null}", id);
+        mock_pool_reply(line);
+        // Like real pools, a session gets the difficulty and a job right away;
+        // a resumed one keeps its extranonce1, so the jobs already out stay valid
+        if (first)
+        {
+            mock_pool_setDifficulty(difficulty);
+            mock_pool_notify(!resumed);
+        }
+    }
+    else if (strcmp(method, "mining.submit") == 0)
+    {
+        mock_pool_submit(id, params);
+    }
+    else
+    {
+        // suggest_difficulty, extranonce.subscribe: acknowledged, the schedule owns the difficulty
+        snprintf(line, sizeof(line), "{\"id\":%llu,\"result\":true,\"error\":null}", id);
+        mock_pool_reply(line);
+    }
+
+    cJSON_Delete(json);
+}
+
+static void mock_pool_submitError(uint32_t channel, uint32_t sequence, const char *code)
+{
+    MockFrame frame(SV2_SUBMIT_SHARES_ERROR, true);
+    frame.u32(channel);
+    frame.u32(sequence);
+    frame.u8((uint8_t)strlen(code));
+    frame.raw(code, strlen(code));
+    mock_pool_reply(frame.finish());
+}
+
+/**
+ * Checks a SubmitSharesStandard the way mock_pool_submit() checks a mining.submit.
+ */
+static void mock_pool_submitStandard(const Sv2Frame &submit)
+{
+    stats.submitted++;
+    if (submit.length < 24)
+    {
+        return;
+    }
+    const uint32_t channel = mock_pool_u32(submit.payload);
+    const uint32_t sequence = mock_pool_u32(submit.payload + 4);
+    const std::string jobId = std::to_string(mock_pool_u32(submit.payload + 8));
+
+    if (!authorized || channel != channelId)
+    {
+        stats.unauthorized++;
+        mock_pool_submitError(channel, sequence, "invalid-channel-id");
+        return;
+    }
+
+    MockJob *job = nullptr;
+    for (MockJob &candidate : jobs)
+    {
+        if (candidate.id == jobId)
+        {
+            job = &candidate;
+        }
+    }
+    if (job == nullptr)
+    {
+        stats.stale++;
+        mock_pool_submitError(channel, sequence, "stale-share");
+        return;
+    }
+    mock_pool_firstShare(*job);
+
+    Block block;
+    mock_pool_header(*job, block);
+    memcpy(block.merkle_root, job->merkle_root.data(), 32);
+    block.nonce = mock_pool_u32(submit.payload + 12);
+    block.ntime = mock_pool_u32(submit.payload + 16);
+    block.version = mock_pool_u32(submit.payload + 20);
+    uint8_t hash[SHA256M_BUFFER_SIZE];
+    sha256_double(reinterpret_cast<uint8_t *>(&block), sizeof(block), hash);
+
+    const double required = job->difficulty < difficulty ? job->difficulty : difficulty;
+    if (diff_from_target(hash) < required)
+    {
+        stats.low_difficulty++;
+        mock_pool_submitError(channel, sequence, "difficulty-too-low");
+        return;
+    }
+
+    MockFrame frame(SV2_SUBMIT_SHARES_SUCCESS, true);
+    frame.u32(channel);
+    frame.u32(sequence);
+    frame.u32(1); // new_submits_accepted_count
+    frame.u32(1); // new_shares_sum, U64
+    frame.u32(0);
+    mock_pool_reply(frame.finish(), millis());
+}
+
+/**
+ * Handles the frames sent by the client in Stratum V2 mode (loopback of the SV2 socket).
+ */
+static void mock_pool_receiveFrame(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (!sv2Decoder.push(data[i]))
+        {
+            continue;
+        }
+        const Sv2Frame &frame = sv2Decoder.frame();
+        switch (frame.msg_type)
+        {
+        case SV2_SETUP_CONNECTION:
+        {
+            MockFrame reply(SV2_SETUP_CONNECTION_SUCCESS, false);
+            reply.u16(SV2_VERSION);
+            reply.u32(0); // flags
+            mock_pool_reply(reply.finish());
+            break;
+        }
+        case SV2_OPEN_STANDARD_MINING_CHANNEL:
+        {
+            // Every channel is a new session, the jobs of the previous one are gone
+            channelId = ++sessionCounter;
+            authorized = true;
+            jobs.clear();
+            uint8_t target[32];
+            difficulty = mock_pool_target(difficulty, target);
+            MockFrame reply(SV2_OPEN_STANDARD_MINING_CHANNEL_SUCCESS, false);
+            reply.u32(frame.length >= 4 ? mock_pool_u32(frame.payload) : 0); // request_id
+            reply.u32(channelId);
+            reply.raw(target, sizeof(target));
+            reply.u8(0);  // extranonce_prefix, empty
+            reply.u32(0); // group_channel_id
+            mock_pool_reply(reply.finish());
+            mock_pool_notify(true);
+            break;
+        }
+        case SV2_SUBMIT_SHARES_STANDARD:
+            mock_pool_submitStandard(frame);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * Starts the mock pool and attaches the client to it.
+ *
+ * @param events The schedule, sorted by time. Must outlive the run.
+ * @param count The number of events.
+ * @param initial The share difficulty announced at authorization.
+ * @param stratumV2 true to speak Stratum V2 on a standard channel instead of Stratum V1.
+ */
+void mock_pool_start(const MockPoolEvent *events, size_t count, double initial, bool stratumV2)
+{
+    schedule = events;
+    scheduleCount = count;
+    scheduleNext = 0;
+    startMs = millis();
+    latencyMs = 0;
+    difficulty = initial;
+    authorized = false;
+    resumed = false;
+    sessionId = "";
+    jobs.clear();
+    replies.clear();
+    stats = MockPoolStats();
+    sv2 = stratumV2;
+    sv2Decoder.reset();
+    channelId = 0;
+    network_setLoopback(mock_pool_receive);
+    sv2_setLoopback(sv2 ? mock_pool_receiveFrame : nullptr);
+}
+
+/**
+ * Fires the due schedule events and delivers the due replies. Call it from the test loop.
+ */
+void mock_pool_loop()
+{
+    const uint32_t now = millis();
+
+    while (scheduleNext < scheduleCount && now - startMs >= schedule[scheduleNext].at_ms)
+    {
+        const MockPoolEvent &event = schedule[scheduleNext++];
+        switch (event.type)
+        {
+        case MOCK_POOL_NOTIFY:
+            mock_pool_notify(event.value != 0);
+            break;
+        case MOCK_POOL_SET_DIFFICULTY:
+            mock_pool_setDifficulty(event.value);
+            break;
+        case MOCK_POOL_DISCONNECT:
+            authorized = false;
+            replies.clear();
+            restart_handshake("mock pool disconnect");
+            break;
+        case MOCK_POOL_DELAY:
+            latencyMs = (uint32_t)event.value;
+            break;
+        }
+    }
+
+    // Deliver in order; a reply is never overtaken by a later one
+    size_t delivered = 0;
+    while (delivered < replies.size() && (int32_t)(millis() - replies[delivered].due_ms) >= 0)
+    {
+        const MockReply &reply = replies[delivered++];
+        if (reply.submit_ms != 0)
+        {
+            const uint32_t latency = millis() - reply.submit_ms;
+            stats.accepted++;
+            stats.accept_latency_ms_total += latency;
+            if (latency > stats.accept_latency_ms_max)
+            {
+                stats.accept_latency_ms_max = latency;
+            }
+        }
+        // The client may answer synchronously, copy the line before the vector grows
+        const std::string line = reply.line;
+        if (sv2)
+        {
+            network_receiveFrame(reinterpret_cast<const uint8_t *>(line.data()), line.size());
+        }
+        else
+        {
+            network_receive(line.c_str());
+        }
+    }
+    replies.erase(replies.begin(), replies.begin() + delivered);
+}
+
+/**
+ * Detaches the client from the mock pool and freezes the stats.
+ */
+void mock_pool_stop()
+{
+    stats.elapsed_ms = millis() - startMs;
+    network_setLoopback(nullptr);
+    sv2_setLoopback(nullptr);
+}
+
+const MockPoolStats &mock_pool_stats()
+{
+    return stats;
+}
+
+void mock_pool_report()
+{
+    const double seconds = stats.elapsed_ms / 1000.0;
+    Serial.printf("Mock pool: %u shares in %.1f s (%.2f shares/s)\n", stats.submitted, seconds, seconds > 0 ? stats.submitted / seconds : 0);
+    Serial.printf("  accepted %u, stale %u (%.1f%%), low difficulty %u, unauthorized %u\n",
+                  stats.accepted, stats.stale, stats.submitted ? 100.0 * stats.stale / stats.submitted : 0, stats.low_difficulty, stats.unauthorized);
+    Serial.printf("  accept latency avg %u ms, max %u ms\n",
+                  stats.accepted ? stats.accept_latency_ms_total / stats.accepted : 0, stats.accept_latency_ms_max);
+    Serial.printf("  notify to first share avg %u ms over %u of %u jobs\n",
+                  stats.first_share_count ? stats.first_share_ms_total / stats.first_share_count : 0, stats.first_share_count, stats.notifies);
+}
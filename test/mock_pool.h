@@ -0,0 +1,46 @@
+#ifndef MOCK_POOL_H
+#define MOCK_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum MockPoolEventType : uint8_t
+{
+    MOCK_POOL_NOTIFY,         // value != 0 starts a new block (clean_jobs)
+    MOCK_POOL_SET_DIFFICULTY, // value is the new share difficulty
+    MOCK_POOL_DISCONNECT,     // drops the session, the client has to handshake again
+    MOCK_POOL_DELAY           // value is the reply latency in ms from now on
+};
+
+/**
+ * One step of a mock pool schedule, fired `at_ms` after mock_pool_start().
+ */
+struct MockPoolEvent
+{
+    uint32_t at_ms;
+    MockPoolEventType type;
+    double value;
+};
+
+struct MockPoolStats
+{
+    uint32_t submitted = 0;
+    uint32_t accepted = 0;
+    uint32_t stale = 0;          // error 21, job unknown or from a previous block
+    uint32_t low_difficulty = 0; // error 23, the hash does not meet the share difficulty
+    uint32_t unauthorized = 0;   // error 24
+    uint32_t notifies = 0;
+    uint32_t accept_latency_ms_total = 0;
+    uint32_t accept_latency_ms_max = 0;
+    uint32_t first_share_ms_total = 0; // notify to first share on that job
+    uint32_t first_share_count = 0;
+    uint32_t elapsed_ms = 0;
+};
+
+void mock_pool_start(const MockPoolEvent *events, size_t count, double difficulty, bool stratumV2 = false);
+void mock_pool_loop();
+void mock_pool_stop();
+const MockPoolStats &mock_pool_stats();
+void mock_pool_report();
+
+#endif // MOCK_POOL_H
@@ -12,6 +12,25 @@
 #include "miner/sha256m.h"
 #include "miner/nerdSHA256plus.h"
 #include "network/network.h"
+#include "network/sv2.h"
+#include "network/pool.h"
+#include "miner/miner.h"
+#include "current.h"
+#include "network/capture.h"
+#include "network/stratum.h"
+#include "telemetry.h"
+#include "network/metrics.h"
+#include "network/shares.h"
+#include "utils/probe.h"
+#include "storage/session.h"
+#include "storage/lifetime.h"
+#include "storage/storage.h"
+#include "network/resolver.h"
+#include "network/tls.h"
+#include "mock_pool.h"
+
+// main.cpp is compiled out of the test build
+Configuration configuration;
 
 void test_create_target(void)
 {
@@ -97,6 +116,138 @@ void test_create_job()
     TEST_ASSERT_EQUAL_STRING(expected_hash, block_header_string);
 }
 
+void test_difficulty_for_share_rate()
+{
+    // 2^32 H/s at 60 shares per minute is exactly one difficulty 1 share per second
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, 1.0, difficulty_for_share_rate(4294967296.0, 60));
+
+    // ~50 kH/s ESP8266 at 6 shares per minute
+    TEST_ASSERT_DOUBLE_WITHIN(1e-8, 1.16415e-4, difficulty_for_share_rate(50000.0, 6));
+
+    // No hashrate yet, nothing to suggest
+    TEST_ASSERT_EQUAL_DOUBLE(0, difficulty_for_share_rate(0, 6));
+}
+
+void test_sv2_frames()
+{
+    // Submit round trip through the decoder, as a local SV2 pool would read it
+    uint8_t out[64];
+    size_t len = sv2_encodeSubmitSharesStandard(out, sizeof(out), 7, 1, 42, 0xdeadbeef, 0x65000000, 0x20000000);
+    TEST_ASSERT_EQUAL(SV2_HEADER_SIZE + 24, len);
+    TEST_ASSERT_EQUAL_HEX8(0x80, out[1]); // channel message
+    TEST_ASSERT_EQUAL_HEX8(SV2_SUBMIT_SHARES_STANDARD, out[2]);
+
+    Sv2Decoder decoder;
+    for (size_t i = 0; i < len; ++i)
+    {
+        TEST_ASSERT_EQUAL(i == len - 1, decoder.push(out[i]));
+    }
+    TEST_ASSERT_EQUAL(24, decoder.frame().length);
+    TEST_ASSERT_EQUAL_HEX8(0xef, decoder.frame().payload[12]); // nonce, little endian
+
+    // NewMiningJob sent by the pool: channel 7, job 42, min_ntime 0x65000000
+    const uint8_t job[] = {0x00, 0x00, SV2_NEW_MINING_JOB, 49, 0, 0,
+                           7, 0, 0, 0, 42, 0, 0, 0, 1, 0, 0, 0, 0x65, 0, 0, 0, 0x20,
+                           1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                           17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+    bool complete = false;
+    for (size_t i = 0; i < sizeof(job); ++i)
+    {
+        complete = decoder.push(job[i]);
+    }
+    TEST_ASSERT_TRUE(complete);
+
+    Sv2NewMiningJob message;
+    TEST_ASSERT_TRUE(sv2_parseNewMiningJob(decoder.frame(), message));
+    TEST_ASSERT_EQUAL(7, message.channel_id);
+    TEST_ASSERT_EQUAL(42, message.job_id);
+    TEST_ASSERT_TRUE(message.has_min_ntime);
+    TEST_ASSERT_EQUAL_HEX32(0x65000000, message.min_ntime);
+    TEST_ASSERT_EQUAL_HEX32(0x20000000, message.version);
+    TEST_ASSERT_EQUAL(32, message.merkle_root[31]);
+
+    // A truncated payload must not parse
+    Sv2Frame truncated = decoder.frame();
+    truncated.length = 20;
+    TEST_ASSERT_FALSE(sv2_parseNewMiningJob(truncated, message));
+}
+
+void test_stratum_dispatch()
+{
+    TEST_ASSERT_EQUAL(STRATUM_NOTIFY, stratum_method("mining.notify"));
+    TEST_ASSERT_EQUAL(STRATUM_SET_DIFFICULTY, stratum_method("mining.set_difficulty"));
+    TEST_ASSERT_EQUAL(STRATUM_SET_EXTRANONCE, stratum_method("mining.set_extranonce"));
+    TEST_ASSERT_EQUAL(STRATUM_UNKNOWN, stratum_method("client.reconnect"));
+    TEST_ASSERT_EQUAL(STRATUM_UNKNOWN, stratum_method("mining.ping"));
+    TEST_ASSERT_EQUAL(STRATUM_UNKNOWN, stratum_method(""));
+
+    // Responses are routed by id, whatever their shape
+    StratumRequest request;
+    stratum_track(1000, STRATUM_SUGGEST_DIFFICULTY, 0, millis());
+    stratum_track(1001, STRATUM_SUBMIT, 7, millis());
+    TEST_ASSERT_TRUE(stratum_take(1001, request));
+    TEST_ASSERT_EQUAL(STRATUM_SUBMIT, request.method);
+    TEST_ASSERT_EQUAL(7, request.context);
+    TEST_ASSERT_TRUE(stratum_take(1000, request));
+    TEST_ASSERT_EQUAL(STRATUM_SUGGEST_DIFFICULTY, request.method);
+
+    // Block candidates are plain submits on the wire, routed apart by id
+    stratum_track(1002, STRATUM_SUBMIT_BLOCK, 7, millis());
+    TEST_ASSERT_TRUE(stratum_take(1002, request));
+    TEST_ASSERT_EQUAL(STRATUM_SUBMIT_BLOCK, request.method);
+    TEST_ASSERT_EQUAL_STRING("mining.submit", stratum_methodName(request.method));
+
+    // Duplicate and late responses find nothing
+    TEST_ASSERT_FALSE(stratum_take(1001, request));
+    stratum_track(2000, STRATUM_SUBMIT, 0, millis());
+    stratum_track(2000 + STRATUM_PENDING_SIZE, STRATUM_SUBMIT, 0, millis());
+    TEST_ASSERT_FALSE(stratum_take(2000, request));
+    TEST_ASSERT_TRUE(stratum_take(2000 + STRATUM_PENDING_SIZE, request));
+
+    // A submit that never got written expires too, counted from when it was built
+    stratum_track(3000, STRATUM_SUBMIT, 0, millis() - 2000);
+    TEST_ASSERT_TRUE(stratum_takeExpired(STRATUM_SUBMIT, 1000, request));
+    TEST_ASSERT_EQUAL(3000, request.id);
+    TEST_ASSERT_EQUAL(0, request.written_ms);
+    TEST_ASSERT_FALSE(stratum_takeExpired(STRATUM_SUBMIT, 1000, request));
+}
+
+void test_telemetry_ring()
+{
+    // Overfill the ring, every sample records a different number of job switches
+    for (size_t i = 0; i < TELEMETRY_SAMPLES + 3; i++)
+    {
+        for (size_t j = 0; j < i % 7; j++)
+        {
+            current_increment_processedJob();
+        }
+        telemetry_sample();
+    }
+
+    TelemetrySample sample;
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLES, telemetry_count());
+    TEST_ASSERT_TRUE(telemetry_get(0, sample));
+    TEST_ASSERT_EQUAL((TELEMETRY_SAMPLES + 2) % 7, sample.job_switches);
+    TEST_ASSERT_TRUE(telemetry_get(TELEMETRY_SAMPLES - 1, sample));
+    TEST_ASSERT_EQUAL(3 % 7, sample.job_switches);
+    TEST_ASSERT_FALSE(telemetry_get(TELEMETRY_SAMPLES, sample));
+}
+
+void test_metrics_render()
+{
+    static char buffer[METRICS_BUFFER_SIZE];
+    const size_t length = metrics_render(buffer, sizeof(buffer));
+    TEST_ASSERT_TRUE(length < sizeof(buffer) - 1); // nothing cut
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "# TYPE leafminer_shares_total counter\n"));
+    TEST_ASSERT_NOT_NULL(strstr(buffer, "leafminer_hashrate_khs{window=\"15m\"} "));
+
+    // A short buffer is filled and terminated, never overrun
+    char small[64];
+    small[sizeof(small) - 1] = 'x';
+    TEST_ASSERT_EQUAL(sizeof(small) - 1, metrics_render(small, sizeof(small) - 1) + 1);
+    TEST_ASSERT_EQUAL('x', small[sizeof(small) - 1]);
+}
+
 void test_double_sha256m()
 {
     const char *msg = "0200000017975b97c18ed1f7e255adf297599b55330edab87803c81701000000000000008a97295a2747b4f1a0b3948df3990344c0e19fa6b2b92b3a19c8e6badc141787358b0553535f011948750833";
@@ -206,6 +357,324 @@ void test_performance_nerdminer()
     TEST_ASSERT_FALSE(is_valid);
 }
 
+void test_mock_pool_pipeline()
+{
+    // 8 s of mining against an in-process pool: new jobs, a new block, a difficulty
+    // change, higher latency and a dropped connection that has to be resumed
+    const MockPoolEvent events[] = {
+        {1000, MOCK_POOL_NOTIFY, 0},
+        {2000, MOCK_POOL_SET_DIFFICULTY, 2e-6},
+        {3000, MOCK_POOL_NOTIFY, 1},
+        {4000, MOCK_POOL_DELAY, 50},
+        {5000, MOCK_POOL_DISCONNECT, 0},
+        {6000, MOCK_POOL_NOTIFY, 0},
+        {7000, MOCK_POOL_NOTIFY, 1},
+    };
+
+    configuration.pool_url = "mock";
+    configuration.pool_port = 3333;
+    pool_setup(configuration);
+    mock_pool_start(events, sizeof(events) / sizeof(events[0]), 1e-6);
+
+    const uint32_t start = millis();
+    while (millis() - start < 8000)
+    {
+        mock_pool_loop();
+        network_listen();
+        network_submit_all();
+        miner(0);
+    }
+
+    const NetworkTxStats tx = network_getTxStats();
+    mock_pool_stop();
+    mock_pool_report();
+    Serial.printf("  %u requests in %u writes (%u bytes)\n", tx.lines, tx.writes, tx.bytes);
+    const ShareLatencySummary toSend = shares_findToSend();
+    const ShareLatencySummary toAck = shares_sendToAck();
+    Serial.printf("  find->send p50 %u ms, p99 %u ms / send->ack p50 %u ms, p99 %u ms\n", toSend.p50_ms, toSend.p99_ms, toAck.p50_ms, toAck.p99_ms);
+
+    const MockPoolStats &stats = mock_pool_stats();
+    TEST_ASSERT_TRUE(stats.accepted > 0);
+    TEST_ASSERT_EQUAL(0, stats.low_difficulty); // every share hashed right
+    TEST_ASSERT_EQUAL(0, stats.unauthorized);   // nothing submitted outside a session
+    TEST_ASSERT_TRUE(stats.first_share_count > 0);
+    TEST_ASSERT_TRUE(tx.writes < tx.lines); // at least the handshakes were coalesced
+    TEST_ASSERT_TRUE(shares_count(SHARE_ACCEPTED) > 0);
+    TEST_ASSERT_TRUE(toAck.count > 0);
+    TEST_ASSERT_TRUE(toAck.total >= toAck.count);
+    TEST_ASSERT_TRUE(toAck.p50_ms <= toAck.p99_ms);
+}
+
+void test_mock_pool_sv2()
+{
+    // 4 s of Stratum V2 mining against the in-process pool: the channel, a job on the same
+    // block, a new target, a new block through SetNewPrevHash and a dropped connection
+    const MockPoolEvent events[] = {
+        {1000, MOCK_POOL_NOTIFY, 0},
+        {1500, MOCK_POOL_SET_DIFFICULTY, 2e-6},
+        {2000, MOCK_POOL_NOTIFY, 1},
+        {3000, MOCK_POOL_DISCONNECT, 0},
+    };
+
+    const Configuration saved = configuration;
+    configuration.pool_url = "stratum2+tcp://mock";
+    configuration.pool_port = 3336;
+    pool_setup(configuration);
+    const uint32_t generation = network_getJobGeneration();
+    const uint32_t accepted = shares_count(SHARE_ACCEPTED);
+    mock_pool_start(events, sizeof(events) / sizeof(events[0]), 1e-6, true);
+
+    const uint32_t start = millis();
+    while (millis() - start < 4000)
+    {
+        mock_pool_loop();
+        network_listen();
+        network_submit_all();
+        miner(0);
+    }
+
+    mock_pool_stop();
+    mock_pool_report();
+
+    const MockPoolStats &stats = mock_pool_stats();
+    TEST_ASSERT_TRUE(stats.accepted > 0);
+    TEST_ASSERT_EQUAL(0, stats.low_difficulty); // every share hashed on the header the pool sent
+    TEST_ASSERT_EQUAL(0, stats.unauthorized);   // nothing submitted outside the open channel
+    TEST_ASSERT_EQUAL(4, stats.notifies);       // a job for each channel, two from the schedule
+    TEST_ASSERT_TRUE(network_getJobGeneration() - generation >= stats.notifies);
+    TEST_ASSERT_TRUE(shares_count(SHARE_ACCEPTED) > accepted);
+    TEST_ASSERT_DOUBLE_WITHIN(2e-8, 2e-6, current_getDifficulty()); // SetTarget, then the new channel
+    TEST_ASSERT_TRUE(sv2_isReady());
+
+    configuration = saved;
+    pool_setup(configuration);
+}
+
+void test_capture_replay()
+{
+    // Record a short mock pool session, then push its inbound side through the client again
+    const MockPoolEvent events[] = {
+        {200, MOCK_POOL_NOTIFY, 0},
+        {400, MOCK_POOL_NOTIFY, 1},
+        {600, MOCK_POOL_SET_DIFFICULTY, 2e-6},
+    };
+
+    const Configuration saved = configuration;
+    configuration.pool_url = "mock";
+    configuration.pool_port = 3333;
+    pool_setup(configuration);
+    TEST_ASSERT_TRUE(capture_start("/test.cap"));
+    mock_pool_start(events, sizeof(events) / sizeof(events[0]), 1e-6);
+
+    const uint32_t start = millis();
+    while (millis() - start < 1000)
+    {
+        mock_pool_loop();
+        network_listen();
+        network_submit_all();
+        miner(0);
+    }
+
+    mock_pool_stop();
+    capture_stop();
+
+    // Cold replay: the session only comes from the recorded subscribe response
+    current_resetSession();
+    const uint32_t accepted = shares_count(SHARE_ACCEPTED);
+
+    CaptureReplayStats stats;
+    TEST_ASSERT_TRUE(capture_replay("/test.cap", false, stats));
+    Serial.printf("Replay: %u lines, %u bytes, %u us total, %u us slowest line, %u jobs\n", stats.inbound, stats.bytes, stats.elapsed_us, stats.max_line_us, stats.jobs);
+    Serial.printf("Replay: %u submits in %u us, %u answered\n", stats.submits, stats.submit_us, stats.answered);
+
+    // subscribe + authorize + extranonce + suggest replies, set_difficulty x2, notify x3
+    TEST_ASSERT_TRUE(stats.inbound >= 9);
+    TEST_ASSERT_NOT_NULL(current_getSessionId());
+    TEST_ASSERT_TRUE(stats.jobs > 0);
+    TEST_ASSERT_TRUE(stats.submits > 0);
+    TEST_ASSERT_TRUE(stats.outbound >= stats.submits + 2); // subscribe and authorize too
+    TEST_ASSERT_TRUE(stats.answered > 0);
+    TEST_ASSERT_TRUE(shares_count(SHARE_ACCEPTED) > accepted);
+    TEST_ASSERT_FALSE(capture_replay("/missing.cap", false, stats));
+
+    configuration = saved;
+    pool_setup(configuration);
+}
+
+void test_session_snapshot()
+{
+    // Keep the session of the board under test
+    SessionSnapshot original;
+    const bool hadSnapshot = session_load(original);
+
+    SessionSnapshot snapshot;
+    snprintf(snapshot.host, sizeof(snapshot.host), "pool.example.com");
+    snapshot.port = 3333;
+    snapshot.address = (uint32_t)IPAddress(192, 0, 2, 7);
+    snprintf(snapshot.session_id, sizeof(snapshot.session_id), "a1b2c3");
+    snprintf(snapshot.extranonce1, sizeof(snapshot.extranonce1), "0badcafe");
+    snapshot.extranonce2_size = 4;
+    snapshot.difficulty = 0.0042;
+    snapshot.accepted = 12;
+    session_update(snapshot);
+    session_save();
+
+    SessionSnapshot loaded;
+    TEST_ASSERT_TRUE(session_load(loaded));
+    TEST_ASSERT_EQUAL_STRING("pool.example.com", loaded.host);
+    TEST_ASSERT_EQUAL(3333, loaded.port);
+    TEST_ASSERT_EQUAL(snapshot.address, loaded.address);
+    TEST_ASSERT_EQUAL_STRING("a1b2c3", loaded.session_id);
+    TEST_ASSERT_EQUAL_STRING("0badcafe", loaded.extranonce1);
+    TEST_ASSERT_EQUAL(4, loaded.extranonce2_size);
+    TEST_ASSERT_EQUAL_DOUBLE(0.0042, loaded.difficulty);
+    TEST_ASSERT_EQUAL(12, loaded.accepted);
+
+    if (hadSnapshot)
+    {
+        session_update(original);
+        session_save();
+    }
+    else
+    {
+        session_clear();
+    }
+}
+
+void test_storage_record()
+{
+    // Keep the configuration of the board under test
+    storage_setup();
+    Configuration original;
+    storage_load(&original);
+
+    Configuration conf;
+    conf.wifi_ssid = "leafnet";
+    conf.wallet_address = "bc1qexample";
+    conf.pool_url = "pool.example.com";
+    conf.pool_port = 21496;
+    conf.blink_enabled = "off";
+    conf.shares_per_minute = 3;
+    storage_setup();
+    storage_save(conf);
+
+    Configuration loaded;
+    storage_setup();
+    storage_load(&loaded);
+    TEST_ASSERT_EQUAL_STRING("leafnet", loaded.wifi_ssid.c_str());
+    TEST_ASSERT_EQUAL_STRING("", loaded.wifi_password.c_str());
+    TEST_ASSERT_EQUAL_STRING("bc1qexample", loaded.wallet_address.c_str());
+    TEST_ASSERT_EQUAL_STRING("pool.example.com", loaded.pool_url.c_str());
+    TEST_ASSERT_EQUAL(21496, loaded.pool_port);
+    TEST_ASSERT_EQUAL_STRING("off", loaded.blink_enabled.c_str());
+    TEST_ASSERT_EQUAL(3, loaded.shares_per_minute);
+    TEST_ASSERT_EQUAL_STRING("pool.example.com", storage_getText(STORAGE_POOL_URL));
+    TEST_ASSERT_EQUAL(21496, storage_getNumber(STORAGE_POOL_PORT));
+
+    storage_save(original);
+}
+
+void test_lifetime_log()
+{
+    TEST_ASSERT_TRUE(lifetime_setup("/test_lifetime.log"));
+    const LifetimeStats before = lifetime_get();
+
+    // Enough appends to go through a compaction, then a reload as after a restart
+    for (size_t i = 0; i < LIFETIME_MAX_DELTAS + 2; i++)
+    {
+        current_increment_hash_accepted();
+        lifetime_save();
+    }
+    TEST_ASSERT_TRUE(lifetime_deltas() < LIFETIME_MAX_DELTAS);
+    TEST_ASSERT_TRUE(lifetime_setup("/test_lifetime.log"));
+
+    const LifetimeStats after = lifetime_get();
+    TEST_ASSERT_EQUAL(before.accepted + LIFETIME_MAX_DELTAS + 2, after.accepted);
+    TEST_ASSERT_TRUE(after.hashes >= before.hashes);
+}
+
+#if defined(TRACE)
+#include <LittleFS.h>
+
+void test_trace_spans()
+{
+    {
+        // Began before the trace, left out
+        PROBE_SCOPE(PROBE_JOB_BUILD);
+        TEST_ASSERT_TRUE(trace_start("/test_trace.json"));
+    }
+    {
+        PROBE_SCOPE(PROBE_JOB_BUILD);
+        delay(2);
+    }
+    trace_stop();
+    TEST_ASSERT_FALSE(trace_isActive());
+
+    File file = LittleFS.open("/test_trace.json", "r");
+    TEST_ASSERT_TRUE((bool)file);
+    const String text = file.readString();
+    file.close();
+
+    // Thread name, the span and the closing instant event
+    cJSON *trace = cJSON_Parse(text.c_str());
+    TEST_ASSERT_NOT_NULL(trace);
+    TEST_ASSERT_EQUAL(3, cJSON_GetArraySize(trace));
+    const cJSON *span = cJSON_GetArrayItem(trace, 1);
+    TEST_ASSERT_EQUAL_STRING("job_build", cJSON_GetObjectItem(span, "name")->valuestring);
+    TEST_ASSERT_EQUAL_STRING("X", cJSON_GetObjectItem(span, "ph")->valuestring);
+    TEST_ASSERT_TRUE(cJSON_GetObjectItem(span, "dur")->valuedouble >= 2000);
+    TEST_ASSERT_TRUE(cJSON_GetObjectItem(span, "ts")->valuedouble < 1000000);
+    TEST_ASSERT_EQUAL(network_getJobGeneration(), cJSON_GetObjectItem(cJSON_GetObjectItem(span, "args"), "generation")->valueint);
+    cJSON_Delete(trace);
+}
+#endif // TRACE
+
+#if defined(TLS_BENCH_HOST)
+#ifndef TLS_BENCH_PORT
+#define TLS_BENCH_PORT 4433
+#endif
+#define TLS_BENCH_HANDSHAKES 4
+
+/**
+ * Times tls_connect() against a local endpoint, on the WiFi of the stored configuration:
+ *   openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=bench -keyout key.pem -out cert.pem
+ *   openssl s_server -accept 4433 -cert cert.pem -key key.pem
+ * and -DTLS_BENCH_HOST=\"<address>\" -DTLS_BENCH_PORT=4433 in build_flags.
+ */
+void test_tls_handshake()
+{
+    Configuration conf;
+    storage_setup();
+    storage_load(&conf);
+    WiFi.begin(conf.wifi_ssid.c_str(), conf.wifi_password.c_str());
+    TEST_ASSERT_EQUAL(WL_CONNECTED, WiFi.waitForConnectResult());
+
+    IPAddress addresses[RESOLVER_MAX_ADDRESSES];
+    const uint8_t count = resolver_resolve(TLS_BENCH_HOST, addresses);
+    TEST_ASSERT_TRUE(count > 0);
+
+    TlsClient bench;
+    uint32_t elapsed[TLS_BENCH_HANDSHAKES];
+    for (uint8_t i = 0; i < TLS_BENCH_HANDSHAKES; i++)
+    {
+        IPAddress address;
+        const uint32_t start = millis();
+        TEST_ASSERT_TRUE(tls_connect(bench, TLS_BENCH_HOST, addresses, count, TLS_BENCH_PORT, address));
+        elapsed[i] = millis() - start;
+        bench.stop();
+        Serial.printf("TLS handshake %u: %u ms\n", i, elapsed[i]);
+    }
+
+#if defined(ESP8266)
+    // The first handshake is a full one, the others resume its session
+    for (uint8_t i = 1; i < TLS_BENCH_HANDSHAKES; i++)
+    {
+        TEST_ASSERT_TRUE(elapsed[i] < elapsed[0]);
+    }
+#endif
+}
+#endif // TLS_BENCH_HOST
+
 void setup()
 {
     Serial.begin(115200);
@@ -214,11 +683,28 @@ void setup()
     RUN_TEST(test_create_block_and_mine);
     RUN_TEST(test_create_target);
     RUN_TEST(test_create_job);
+    RUN_TEST(test_difficulty_for_share_rate);
+    RUN_TEST(test_sv2_frames);
+    RUN_TEST(test_stratum_dispatch);
+    RUN_TEST(test_telemetry_ring);
+    RUN_TEST(test_metrics_render);
+    RUN_TEST(test_session_snapshot);
+    RUN_TEST(test_storage_record);
+    RUN_TEST(test_lifetime_log);
+#if defined(TRACE)
+    RUN_TEST(test_trace_spans);
+#endif
     RUN_TEST(test_double_sha256m);
     RUN_TEST(test_nerdminer);
 
     // Performance Testing
     RUN_TEST(test_performance_nerdminer);
+    RUN_TEST(test_mock_pool_pipeline);
+    RUN_TEST(test_mock_pool_sv2);
+    RUN_TEST(test_capture_replay);
+#if defined(TLS_BENCH_HOST)
+    RUN_TEST(test_tls_handshake);
+#endif
 
     UNITY_END();
 }